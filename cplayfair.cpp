@@ -0,0 +1,99 @@
+#include "cplayfair.h"
+#include "playfair.h"
+ 
+struct pf_key
+{
+    virtual ~pf_key() {}
+    virtual size_t doIt( const char* t, size_t n, bool e, char* out ) const = 0;
+    virtual uint64_t id() const = 0;
+};
+ 
+template< class K > struct pf_keyOf : pf_key
+{
+    pf_keyOf( string k, bool ij ) : _k( k, ij ) {}
+    pf_keyOf( string k1, string k2, bool ij ) : _k( k1, k2, ij ) {}
+    size_t doIt( const char* t, size_t n, bool e, char* out ) const { return _k.doIt( t, n, e, out ); }
+    uint64_t id() const { return _k.id(); }
+    static void* operator new( size_t n ) { return hugeAlloc( n ); }
+    static void operator delete( void* p, size_t n ) { hugeFree( p, n ); }
+    K _k;
+};
+ 
+struct pf_cache : resultCache
+{
+    pf_cache( size_t entries, size_t bytes ) : resultCache( entries, bytes ) {}
+};
+ 
+template< class A > static pf_key* newKey( const string& k1, const string& k2, unsigned flags )
+{
+    bool ij = !( flags & PF_DROP_Q );
+    if( flags & PF_TWO_SQUARE ) return new pf_keyOf< basicTwoSquare<A> >( k1, k2, ij );
+    if( flags & PF_FOUR_SQUARE ) return new pf_keyOf< basicFourSquare<A> >( k1, k2, ij );
+    return new pf_keyOf< basicKey<A> >( k1, ij );
+}
+ 
+static pf_key* newKey( const string& k1, const string& k2, unsigned flags )
+{
+    try
+    {
+	if( ( flags & PF_ALNUM ) && ( flags & PF_BYTES ) ) return 0;
+	if( ( flags & PF_TWO_SQUARE ) && ( flags & PF_FOUR_SQUARE ) ) return 0;
+	if( flags & PF_ALNUM ) return newKey<alpha36>( k1, k2, flags );
+	if( flags & PF_BYTES ) return newKey<alpha256>( k1, k2, flags );
+	return newKey<alpha25>( k1, k2, flags );
+    }
+    catch( ... ) { return 0; }
+}
+ 
+pf_key* pf_key_new( const char* key, size_t len, unsigned flags )
+{
+    if( flags & ( PF_TWO_SQUARE | PF_FOUR_SQUARE ) ) return 0;
+    return newKey( string( key, len ), "", flags );
+}
+ 
+pf_key* pf_key_new2( const char* key1, size_t len1, const char* key2, size_t len2, unsigned flags )
+{
+    if( !( flags & ( PF_TWO_SQUARE | PF_FOUR_SQUARE ) ) ) return 0;
+    return newKey( string( key1, len1 ), string( key2, len2 ), flags );
+}
+ 
+void pf_key_free( pf_key* k ) { delete k; }
+ 
+size_t pf_max_output( size_t len ) { return playfair::maxReady( len ); }
+ 
+size_t pf_crypt( const pf_key* k, const char* in, size_t len, char* out, int encrypt )
+{
+    return k->doIt( in, len, encrypt != 0, out );
+}
+ 
+int pf_crypt_batch( const pf_key* k, const pf_slice* in, size_t n, char* out, size_t cap, size_t* offsets, int encrypt )
+{
+    size_t o = 0; offsets[0] = 0;
+    for( size_t x = 0; x < n; x++ )
+    {
+	if( pf_max_output( in[x].len ) > cap - o ) return -1;
+	offsets[x + 1] = o += k->doIt( in[x].ptr, in[x].len, encrypt != 0, out + o );
+    }
+    return 0;
+}
+ 
+pf_cache* pf_cache_new( size_t entries, size_t bytes )
+{
+    try { return new pf_cache( entries, bytes ); }
+    catch( ... ) { return 0; }
+}
+ 
+void pf_cache_free( pf_cache* c ) { delete c; }
+ 
+size_t pf_crypt_cached( pf_cache* c, const pf_key* k, const char* in, size_t len, char* out, int encrypt )
+{
+    try { return c->doIt( *k, in, len, encrypt != 0, out ); }
+    catch( ... ) { return k->doIt( in, len, encrypt != 0, out ); }
+}
+ 
+void pf_cache_stats( const pf_cache* c, size_t* hits, size_t* misses, size_t* evictions )
+{
+    if( hits ) *hits = c->hits();
+    if( misses ) *misses = c->misses();
+    if( evictions ) *evictions = c->evictions();
+}
@@ -0,0 +1,50 @@
+#ifndef CPLAYFAIR_H
+#define CPLAYFAIR_H
+ 
+#include <stddef.h>
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+ 
+/* key flags */
+#define PF_DROP_Q      1   /* drop Q instead of merging I/J (5x5 grids) */
+#define PF_ALNUM       2   /* 6x6 A-Z/0-9 grid */
+#define PF_BYTES       4   /* 16x16 raw byte grid */
+#define PF_TWO_SQUARE  8   /* pf_key_new2 only */
+#define PF_FOUR_SQUARE 16  /* pf_key_new2 only */
+ 
+typedef struct pf_key pf_key;
+typedef struct { const char* ptr; size_t len; } pf_slice;
+ 
+/* Compiled keys are immutable: one handle may be used from any number of threads.
+   The en/decrypt calls never allocate. Returns NULL on bad flags or no memory. */
+pf_key* pf_key_new( const char* key, size_t len, unsigned flags );
+pf_key* pf_key_new2( const char* key1, size_t len1, const char* key2, size_t len2, unsigned flags );
+void pf_key_free( pf_key* k );
+ 
+/* output bytes needed for an input of len bytes */
+size_t pf_max_output( size_t len );
+ 
+/* en/decrypts one message into out, which holds pf_max_output( len ) bytes;
+   returns the output length */
+size_t pf_crypt( const pf_key* k, const char* in, size_t len, char* out, int encrypt );
+ 
+/* en/decrypts n messages into one buffer of cap bytes; message x is written to
+   out[offsets[x], offsets[x + 1]), so offsets holds n + 1 entries. Returns 0, or -1
+   (with offsets[0 .. x] filled) when message x did not fit. */
+int pf_crypt_batch( const pf_key* k, const pf_slice* in, size_t n, char* out, size_t cap, size_t* offsets, int encrypt );
+ 
+/* Optional bounded result cache for repeated messages, safe to share between
+   threads; it allocates when storing a new result. */
+typedef struct pf_cache pf_cache;
+pf_cache* pf_cache_new( size_t entries, size_t bytes );
+void pf_cache_free( pf_cache* c );
+size_t pf_crypt_cached( pf_cache* c, const pf_key* k, const char* in, size_t len, char* out, int encrypt );
+void pf_cache_stats( const pf_cache* c, size_t* hits, size_t* misses, size_t* evictions );
+ 
+#ifdef __cplusplus
+}
+#endif
+ 
+#endif
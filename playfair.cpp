@@ -1,106 +1,1288 @@
-#include <bits/stdc++.h>
+#include "playfair.h"
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#if __has_include( <zlib.h> ) && !defined( PLAYFAIR_NO_ZLIB )
+#include <zlib.h>
+#define PLAYFAIR_ZLIB
+#endif
+#if __has_include( <zstd.h> ) && !defined( PLAYFAIR_NO_ZSTD )
+#include <zstd.h>
+#define PLAYFAIR_ZSTD
+#endif
  
-using namespace std;
+enum { ST_REQUEST, ST_LOOKUP, ST_NORMALIZE, ST_CIPHER, ST_OUTPUT, ST_READ, STAGES };
+static const char* const stageNames[STAGES] = { "request", "lookup", "normalize", "cipher", "output", "read" };
  
-class playfair
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+ 
+// --stats report: throughput plus the latency percentiles of every stage that ran
+static void printStats( const latencyHistogram* lat, size_t msgs, size_t bytes, uint64_t ns )
+{
+    cerr << "{\"messages\":" << msgs << ",\"bytes_in\":" << bytes << ",\"seconds\":" << ns / 1e9
+         << ",\"mb_per_s\":" << ( ns ? bytes * 1e3 / ns : 0 ) << ",\"stages\":{";
+    for( int x = 0, n = 0; x < STAGES; x++ )
+	if( lat[x].count() ) cerr << ( n++ ? "," : "" ) << "\"" << stageNames[x] << "\":" << lat[x].json();
+    cerr << "}}" << endl;
+}
+ 
+// NUMA nodes with CPUs, read from sysfs; without that tree the machine is one node
+// with every CPU. Workers are spread over the nodes round-robin, and read-mostly
+// tables are copied once per node by a thread pinned there, so the first touch
+// places the copy in that node's memory.
+class numaMap
 {
 public:
-    void doIt( string k, string t, bool ij, bool e )
+    numaMap()
     {
-	createGrid( k, ij ); getTextReady( t, ij, e );
-	if( e ) doIt( 1 ); else doIt( -1 );
-	display();
+	ifstream on( "/sys/devices/system/node/online" ); string l; vector<int> ids;
+	if( on && getline( on, l ) ) ids = list( l );
+	for( size_t x = 0; x < ids.size(); x++ )
+	{
+	    ifstream f( "/sys/devices/system/node/node" + to_string( ids[x] ) + "/cpulist" ); string c;
+	    if( f && getline( f, c ) && !list( c ).empty() ) _cpus.push_back( list( c ) );
+	}
+	if( _cpus.empty() ) _cpus.push_back( vector<int>() );
+    }
+
+    size_t nodes() const { return _cpus.size(); }
+    size_t nodeOf( size_t worker ) const { return worker % _cpus.size(); }
+
+    // binds the calling thread to the CPUs of node n; false if not possible
+    bool pin( size_t n ) const
+    {
+	if( _cpus[n].empty() ) return false;
+	cpu_set_t set; CPU_ZERO( &set );
+	for( size_t x = 0; x < _cpus[n].size(); x++ ) if( _cpus[n][x] < CPU_SETSIZE ) CPU_SET( _cpus[n][x], &set );
+	return !pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
     }
+
+    // one copy of k per node, each made on that node
+    template< class K > vector< unique_ptr<const K> > replicate( const K& k ) const
+    {
+	vector< unique_ptr<const K> > r( nodes() );
+	for( size_t n = 0; n < nodes(); n++ ) thread( [&, n]() { pin( n ); r[n].reset( new K( k ) ); } ).join();
+	return r;
+    }
+
+private:
+    // "0-3,8,10-11" as a list of numbers
+    static vector<int> list( const string& s )
+    {
+	vector<int> r;
+	for( const char* p = s.c_str(); *p; )
+	{
+	    char* end; long a = strtol( p, &end, 10 ), b = a; if( end == p ) break;
+	    if( *end == '-' ) b = strtol( end + 1, &end, 10 );
+	    for( ; a <= b; a++ ) r.push_back( a );
+	    p = *end ? end + 1 : end;
+	}
+	return r;
+    }
+
+    vector< vector<int> > _cpus;
+};
+ 
+enum codec { RAW, GZIP, ZSTD };
  
+static bool putAll( int fd, const char* p, size_t n )
+{
+    for( ssize_t w; n; p += w, n -= w )
+	if( ( w = write( fd, p, n ) ) < 0 && errno != EINTR ) return false;
+	else if( w < 0 ) w = 0;
+    return true;
+}
+ 
+// Stream source for the file modes: a thread of its own reads fd, inflates gzip or
+// zstd input (told apart from plain input by the magic bytes, unless sniff is off)
+// and passes the plain bytes on in blocks through a bounded queue, so decompression
+// overlaps the stages reading the stream.
+class sourceBuf : public streambuf
+{
+public:
+    sourceBuf( int fd, bool sniff ) : _fd( fd ), _sniff( sniff ), _q( 4, 2 ), _ok( true ) { _t = thread( [this]() { pump(); } ); }
+    ~sourceBuf() { _q.close(); _t.join(); }
+
+    // false if compressed input was corrupt, truncated or not supported by this build
+    bool ok() const { return _ok; }
+
+protected:
+    int_type underflow()
+    {
+	if( !_q.pop( _cur ) ) return traits_type::eof();
+	setg( &_cur[0], &_cur[0], &_cur[0] + _cur.size() ); return traits_type::to_int_type( _cur[0] );
+    }
+
 private:
-    void doIt( int dir )
+    enum { BLOCK = 1 << 20 };
+
+    // the next input block into in; false at the end
+    bool get( string& in )
+    {
+	in.resize( BLOCK ); ssize_t n;
+	while( ( n = read( _fd, &in[0], BLOCK ) ) < 0 && errno == EINTR );
+	in.resize( max( n, ssize_t( 0 ) ) ); return n > 0;
+    }
+
+    void pump()
     {
-	int a, b, c, d; string ntxt;
-	for( string::const_iterator ti = _txt.begin(); ti != _txt.end(); ti++ )
+	string in; bool more = get( in );
+	if( _sniff && in.size() >= 2 && in[0] == '\x1f' && in[1] == '\x8b' ) gunzip( in );
+	else if( _sniff && in.size() >= 4 && !memcmp( in.data(), "\x28\xb5\x2f\xfd", 4 ) ) unzstd( in );
+	else while( more && _q.push( move( in ) ) ) more = get( in );
+	_q.close();
+    }
+
+    void gunzip( string& in )
+    {
+#ifdef PLAYFAIR_ZLIB
+	z_stream z = z_stream(); string out; bool end = false;
+	if( inflateInit2( &z, 15 + 16 ) != Z_OK ) { _ok = false; return; }
+	do
 	{
-	    if( getCharPos( *ti++, a, b ) )
-		if( getCharPos( *ti, c, d ) )
-		{
-		    if( a == c )     { ntxt += getChar( a, b + dir ); ntxt += getChar( c, d + dir ); }
-		    else if( b == d ){ ntxt += getChar( a + dir, b ); ntxt += getChar( c + dir, d ); }
-		    else             { ntxt += getChar( c, b ); ntxt += getChar( a, d ); }
-		}
+	    z.next_in = ( Bytef* )in.data(); z.avail_in = in.size();
+	    for( bool full = true; full || z.avail_in; )
+	    {
+		out.resize( BLOCK ); z.next_out = ( Bytef* )&out[0]; z.avail_out = BLOCK;
+		int r = inflate( &z, Z_NO_FLUSH );
+		if( r == Z_STREAM_END ) end = true, inflateReset( &z );
+		else if( r == Z_OK ) end = false;
+		else if( r != Z_BUF_ERROR ) { _ok = false; inflateEnd( &z ); return; }
+		full = !z.avail_out; out.resize( BLOCK - z.avail_out );
+		if( !out.empty() && !_q.push( move( out ) ) ) { inflateEnd( &z ); return; }
+	    }
+	}
+	while( get( in ) );
+	_ok = end; inflateEnd( &z );
+#else
+	( void )in; _ok = false;
+#endif
+    }
+
+    void unzstd( string& in )
+    {
+#ifdef PLAYFAIR_ZSTD
+	ZSTD_DCtx* d = ZSTD_createDCtx(); string out; size_t left = 0;
+	do
+	{
+	    ZSTD_inBuffer i = { in.data(), in.size(), 0 };
+	    for( bool full = true; full || i.pos < i.size; )
+	    {
+		out.resize( BLOCK ); ZSTD_outBuffer o = { &out[0], BLOCK, 0 };
+		left = ZSTD_decompressStream( d, &o, &i );
+		if( ZSTD_isError( left ) ) { _ok = false; ZSTD_freeDCtx( d ); return; }
+		full = o.pos == o.size; out.resize( o.pos );
+		if( !out.empty() && !_q.push( move( out ) ) ) { ZSTD_freeDCtx( d ); return; }
+	    }
 	}
-	_txt = ntxt;
+	while( get( in ) );
+	_ok = !left; ZSTD_freeDCtx( d );
+#else
+	( void )in; _ok = false;
+#endif
     }
+
+    int _fd; bool _sniff; boundedQueue<string> _q; atomic<bool> _ok; string _cur; thread _t;
+};
  
-    void display()
+// Stream sink for the file modes: the stream's bytes are cut into blocks that a
+// thread of its own compresses as gzip or zstd (or not) and writes to fd.
+class sinkBuf : public streambuf
+{
+public:
+    sinkBuf( int fd, codec c ) : _fd( fd ), _c( c ), _q( 4, 2 ), _ok( true )
+    {
+	fresh(); _t = thread( [this]() { pump(); } );
+    }
+
+    ~sinkBuf() { close(); }
+
+    // flushes, ends the compressed stream and waits for the writes; false if any failed
+    bool close()
     {
-	cout << "\n\n OUTPUT:\n=========" << endl;
-	string::iterator si = _txt.begin(); int cnt = 0;
-	while( si != _txt.end() )
+	if( _t.joinable() ) { ship(); _q.close(); _t.join(); }
+	return _ok;
+    }
+
+protected:
+    int_type overflow( int_type c )
+    {
+	ship(); fresh();
+	if( !traits_type::eq_int_type( c, traits_type::eof() ) ) { *pptr() = c; pbump( 1 ); }
+	return traits_type::not_eof( c );
+    }
+
+private:
+    enum { BLOCK = 1 << 20 };
+
+    void fresh() { _buf.resize( BLOCK ); setp( &_buf[0], &_buf[0] + BLOCK ); }
+    void ship() { _buf.resize( pptr() - pbase() ); if( !_buf.empty() ) _q.push( move( _buf ) ); setp( 0, 0 ); }
+
+    void put( const char* p, size_t n ) { if( _ok && !putAll( _fd, p, n ) ) _ok = false; }
+
+    void pump()
+    {
+	string b, out;
+#ifdef PLAYFAIR_ZLIB
+	if( _c == GZIP )
+	{
+	    z_stream z = z_stream();
+	    if( deflateInit2( &z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) { _ok = false; while( _q.pop( b ) ); return; }
+	    for( bool more = true; more; )
+	    {
+		more = _q.pop( b ); z.next_in = ( Bytef* )b.data(); z.avail_in = more ? b.size() : 0;
+		do
+		{
+		    out.resize( BLOCK ); z.next_out = ( Bytef* )&out[0]; z.avail_out = BLOCK;
+		    deflate( &z, more ? Z_NO_FLUSH : Z_FINISH ); put( out.data(), BLOCK - z.avail_out );
+		}
+		while( !z.avail_out );
+	    }
+	    deflateEnd( &z ); return;
+	}
+#endif
+#ifdef PLAYFAIR_ZSTD
+	if( _c == ZSTD )
 	{
-	    cout << *si; si++; cout << *si << " "; si++;
-	    if( ++cnt >= 26 ) cout << endl, cnt = 0;
+	    ZSTD_CCtx* x = ZSTD_createCCtx();
+	    for( bool more = true; more; )
+	    {
+		more = _q.pop( b ); ZSTD_inBuffer i = { b.data(), more ? b.size() : 0, 0 }; size_t left;
+		do
+		{
+		    out.resize( BLOCK ); ZSTD_outBuffer o = { &out[0], BLOCK, 0 };
+		    left = ZSTD_compressStream2( x, &o, &i, more ? ZSTD_e_continue : ZSTD_e_end );
+		    if( ZSTD_isError( left ) ) { _ok = false; break; }
+		    put( out.data(), o.pos );
+		}
+		while( more ? i.pos < i.size : left != 0 );
+	    }
+	    ZSTD_freeCCtx( x ); return;
 	}
-	cout << endl << endl;
+#endif
+	while( _q.pop( b ) ) put( b.data(), b.size() );
     }
+
+    int _fd; codec _c; boundedQueue<string> _q; atomic<bool> _ok; string _buf; thread _t;
+};
  
-    char getChar( int a, int b )
+// runs mode( in, out ) on stdin and stdout through a sourceBuf and a sinkBuf; modes
+// whose input is arbitrary bytes turn sniff off, as their input may start like gzip
+template< class F > static int fileMode( codec c, F mode, bool sniff = true )
+{
+    sourceBuf src( 0, sniff ); istream in( &src ); int r;
     {
-	return _m[ (b + 5) % 5 ][ (a + 5) % 5 ];
+	sinkBuf dst( 1, c ); ostream out( &dst );
+	r = mode( in, out ); out.flush();
+	if( !dst.close() ) { cerr << "write failed" << endl; r = 1; }
     }
+    if( !src.ok() ) { cerr << "compressed input is corrupt, truncated or not supported by this build" << endl; r = 1; }
+    return r;
+}
+ 
+// up to 65536 input lines, or as many as fill BATCH_BYTES, packed, and their output
+// once ciphered; fmt holds the lines' layouts in format-preserving runs
+struct bulkBatch { enum { BATCH_BYTES = 4 << 20 }; string data; vector<size_t> off, outOff; vector<char> out; textLayout fmt; };
  
-    bool getCharPos( char l, int &a, int &b )
+// high and low are the queue watermarks in batches between the pipeline stages;
+// format keeps every dropped byte and the letter case of the input in the output;
+// unfill strips the fillers from decrypted lines, pad their final X as well, and
+// reports on stderr how many X went, as any of them may have been a real letter
+template< class A > static int bulkMode( const basicKey<A>& ck, istream& in, ostream& out, bool e, bool format, bool unfill, bool pad, size_t cache, bool stats, size_t high, size_t low )
+{
+    string line; latencyHistogram lat[STAGES]; size_t msgs = 0, bytes = 0, stripped = 0, strippedLines = 0; uint64_t start = nowNs(), t0;
+    auto strip = [&]( char* p, size_t len ) {
+	size_t was = stripped; len = ck.unfill( p, len, pad, &stripped );
+	strippedLines += stripped != was;
+	return len;
+    };
+    auto report = [&]() {
+	if( stripped )
+	    cerr << "unfill: " << stripped << " X stripped from " << strippedLines << " lines; each may have been a real X (AAB and AXAB decrypt alike)" << endl;
+    };
+    if( cache && !format )
+    {
+	resultCache rc( cache, cache << 10 ); vector<char> buf;
+	while( getline( in, line ) )
+	{
+	    buf.resize( basicPlayfair<A>::maxReady( line.length() ) ); t0 = nowNs();
+	    size_t len = rc.doIt( ck, line.data(), line.length(), e, buf.data() );
+	    out.write( buf.data(), unfill ? strip( buf.data(), len ) : len ).put( '\n' );
+	    if( stats ) lat[ST_REQUEST].record( nowNs() - t0 ), msgs++, bytes += line.length() + 1;
+	}
+	ostringstream rate; rate << fixed << setprecision( 1 ) << 100 * rc.hitRate();
+	cerr << "cache: " << rc.hits() << " hits, " << rc.misses() << " misses, " << rc.evictions() << " evictions ("
+	     << rate.str() << "% hit rate)" << endl;
+	report();
+	if( stats ) printStats( lat, msgs, bytes, nowNs() - start );
+	return 0;
+    }
+    // read, normalize, cipher and write run as threads joined by bounded queues of
+    // batches, so a slow writer stalls the reader instead of piling up input
+    typedef unique_ptr<bulkBatch> item; boundedQueue<item> read( high, low ), ready( high, low ), done( high, low );
+    thread reader( [&]() {
+	for( uint64_t t0; in; )
+	{
+	    item b( new bulkBatch ); b->off.assign( 1, 0 ); t0 = nowNs();
+	    while( b->off.size() <= 65536 && b->data.length() < bulkBatch::BATCH_BYTES && getline( in, line ) ) b->data += line, b->off.push_back( b->data.length() );
+	    if( stats ) lat[ST_READ].record( nowNs() - t0 );
+	    if( b->off.size() > 1 && !read.push( move( b ) ) ) break;
+	}
+	read.close();
+    } );
+    thread normalizer( [&]() {
+	for( item b; read.pop( b ); )
+	{
+	    uint64_t t0 = nowNs();
+	    if( format ) ck.prepare( b->data.data(), b->off.data(), b->off.size() - 1, e, b->out, b->outOff, b->fmt );
+	    else ck.prepare( b->data.data(), b->off.data(), b->off.size() - 1, e, b->out, b->outOff );
+	    if( stats ) lat[ST_NORMALIZE].record( nowNs() - t0 );
+	    if( !ready.push( move( b ) ) ) break;
+	}
+	ready.close();
+    } );
+    thread cipher( [&]() {
+	for( item b; ready.pop( b ); )
+	{
+	    uint64_t t0 = nowNs();
+	    ck.crypt( b->out.data(), b->out.data(), b->out.size(), e );
+	    if( stats ) lat[ST_CIPHER].record( nowNs() - t0 );
+	    if( !done.push( move( b ) ) ) break;
+	}
+	done.close();
+    } );
+    vector<char> tmp;
+    for( item b; done.pop( b ); )
     {
-	for( int y = 0; y < 5; y++ )
-	    for( int x = 0; x < 5; x++ )
-		if( _m[y][x] == l )
-		{ a = x; b = y; return true; }
+	t0 = nowNs();
+	if( format )
+	{
+	    tmp.resize( b->fmt.dropped.size() + b->out.size() + b->outOff.size() ); size_t o = 0;
+	    for( size_t x = 0; x + 1 < b->outOff.size(); x++ )
+		o += basicPlayfair<A>::restore( b->out.data() + b->outOff[x], b->fmt, x, tmp.data() + o ), tmp[o++] = '\n';
+	    out.write( tmp.data(), o );
+	}
+	else
+	    for( size_t x = 0; x + 1 < b->outOff.size(); x++ )
+	    {
+		char* p = b->out.data() + b->outOff[x]; size_t len = b->outOff[x + 1] - b->outOff[x];
+		out.write( p, unfill ? strip( p, len ) : len ).put( '\n' );
+	    }
+	if( stats ) lat[ST_OUTPUT].record( nowNs() - t0 ), msgs += b->off.size() - 1, bytes += b->data.length() + b->off.size() - 1;
+    }
+    reader.join(); normalizer.join(); cipher.join();
+    report();
+    if( stats ) printStats( lat, msgs, bytes, nowNs() - start );
+    return 0;
+}
  
-	return false;
+template< class A > static int bulkMode( const vector<string>& args, istream& in, ostream& out, bool ij, bool e, bool format, bool unfill, bool pad, size_t cache, bool stats, size_t high, size_t low )
+{
+    if( args[0] == "--two" ) return bulkMode<A>( basicTwoSquare<A>( args[1], args[2], ij ), in, out, e, format, unfill, pad, cache, stats, high, low );
+    if( args[0] == "--four" ) return bulkMode<A>( basicFourSquare<A>( args[1], args[2], ij ), in, out, e, format, unfill, pad, cache, stats, high, low );
+    return bulkMode<A>( basicKey<A>( args[1], ij ), in, out, e, format, unfill, pad, cache, stats, high, low );
+}
+ 
+// ciphers the selected (1-based) columns of a CSV stream; every other byte is copied
+// through. Input is read in large blocks that are cut into one chunk per thread at
+// row boundaries outside quotes, and the chunks are written back in input order.
+// With header set the first row, quoted newlines and all, is copied through too.
+// Given a numaMap, chunk t always goes to a thread pinned to node nodeOf( t ) that
+// uses that node's copy of the key, and the part of the block buffer chunk t
+// usually lands in is first touched there.
+template< class A > class csvCrypt
+{
+public:
+    csvCrypt( const basicKey<A>& ck, const string& cols, bool e, char sep, bool header, const numaMap* numa = 0 ) :
+	_ck( ck ), _e( e ), _header( header ), _sep( sep ), _numa( numa )
+    {
+	if( _numa ) _local = _numa->replicate( ck );
+	for( const char* c = cols.c_str(); *c; )
+	{
+	    char* end; long f = strtol( c, &end, 10 ); if( end == c ) break;
+	    if( f > 0 ) { if( _cols.size() < size_t( f ) ) _cols.resize( f ); _cols[f - 1] = true; }
+	    c = *end ? end + 1 : end;
+	}
+    }
+
+    void run( istream& in, ostream& out, unsigned threads )
+    {
+	const size_t block = 4 << 20; size_t cap = 2 * block * threads, keep = 0; vector<string> res( threads );
+	unique_ptr<char[]> buf( new char[cap] );
+	if( _numa ) parallel( threads, [&]( unsigned t ) { memset( buf.get() + t * block, 0, t + 1 < threads ? block : cap - t * block ); } );
+	for( bool last = false, head = _header, q = false; !last; )
+	{
+	    if( keep + block * threads > cap )
+	    {
+		unique_ptr<char[]> b( new char[cap = keep + block * threads] ); memcpy( b.get(), buf.get(), keep ); buf.swap( b );
+	    }
+	    in.read( buf.get() + keep, block * threads ); size_t n = keep + in.gcount(); last = !in;
+	    if( head )
+	    {
+		size_t s = header( buf.get(), n, q, head ); out.write( buf.get(), s ); memmove( buf.get(), buf.get() + s, n -= s );
+	    }
+	    vector<size_t> cut = split( buf.get(), n, threads, last );
+	    parallel( threads, [&]( unsigned t ) { res[t].clear(); rows( _numa ? *_local[_numa->nodeOf( t )] : _ck, buf.get() + cut[t], cut[t + 1] - cut[t], res[t] ); } );
+	    for( unsigned t = 0; t < threads; t++ ) out << res[t];
+	    memmove( buf.get(), buf.get() + cut[threads], keep = n - cut[threads] );
+	}
+    }
+
+private:
+    // f( t ) on threads 0..threads-1, pinned to their nodes when placement is on
+    template< class F > void parallel( unsigned threads, F f ) const
+    {
+	vector<thread> pool;
+	for( unsigned t = 0; t < threads; t++ )
+	    pool.push_back( thread( [&, t]() { if( _numa ) _numa->pin( _numa->nodeOf( t ) ); f( t ); } ) );
+	for( unsigned t = 0; t < threads; t++ ) pool[t].join();
+    }
+
+    // the bytes of p[0, n) up to and including the first newline outside quotes,
+    // clearing head once it is found; q carries the quote state across blocks
+    size_t header( const char* p, size_t n, bool& q, bool& head ) const
+    {
+	for( size_t i = 0; ( i = scan( p, n, i, '"', '\n', '\n' ) ) < n; i++ )
+	    if( p[i] == '"' ) q = !q;
+	    else if( !q ) { head = false; return i + 1; }
+	return n;
+    }
+
+    vector<size_t> split( const char* p, size_t n, unsigned parts, bool last ) const
+    {
+	vector<size_t> cut( 1, 0 ); size_t end = 0; bool q = false;
+	for( size_t i = 0; ( i = scan( p, n, i, '"', '\n', '\n' ) ) < n; i++ )
+	{
+	    if( p[i] == '"' ) { q = !q; continue; }
+	    if( q ) continue;
+	    end = i + 1;
+	    if( cut.size() < parts && end >= cut.size() * ( n / parts ) ) cut.push_back( end );
+	}
+	if( last ) end = n;
+	while( cut.size() <= parts ) cut.push_back( end );
+	cut[parts] = end;
+	return cut;
+    }
+
+    void rows( const basicKey<A>& ck, const char* p, size_t n, string& out ) const
+    {
+	vector<char> tmp; size_t f = 0;
+	for( size_t i = 0; i < n; )
+	{
+	    size_t j = i;
+	    if( p[i] == '"' )
+		for( j = i + 1; ( j = scan( p, n, j, '"', '"', '"' ) ) < n; j += 2 )
+		    if( j + 1 >= n || p[j + 1] != '"' ) { j++; break; }
+	    size_t end = scan( p, n, min( j, n ), _sep, '\n', _sep ), fe = end;
+	    if( end < n && p[end] == '\n' && fe > i && p[fe - 1] == '\r' ) fe--;
+	    if( f < _cols.size() && _cols[f] )
+	    {
+		tmp.resize( basicPlayfair<A>::maxReady( fe - i ) );
+		out.append( tmp.data(), ck.doIt( p + i, fe - i, _e, tmp.data() ) );
+	    }
+	    else out.append( p + i, fe - i );
+	    out.append( p + fe, min( end + 1, n ) - fe );
+	    f = end < n && p[end] == '\n' ? 0 : f + 1; i = end + 1;
+	}
     }
+
+    const basicKey<A>& _ck; vector<bool> _cols; bool _e, _header; char _sep;
+    const numaMap* _numa; vector< unique_ptr< const basicKey<A> > > _local;
+};
  
-    void getTextReady( string t, bool ij, bool e )
+// ciphers the string values at the given JSON pointers of a JSON/JSONL stream
+// without building a DOM: a byte-level tokenizer tracks only the current path, and
+// everything but the target strings is copied through. Memory is bounded by the
+// input block plus the longest target string.
+template< class A > class jsonCrypt
+{
+public:
+    jsonCrypt( const basicKey<A>& ck, const vector<string>& ptrs, bool e ) :
+	_ck( ck ), _e( e ), _ptrs( ptrs.begin(), ptrs.end() ), _str( NONE ), _esc( false ) {}
+
+    void run( istream& in, ostream& out )
+    {
+	vector<char> buf( 1 << 16 ); string o;
+	while( in.read( buf.data(), buf.size() ) || in.gcount() )
+	{
+	    o.clear(); feed( buf.data(), in.gcount(), o ); out << o;
+	}
+    }
+
+private:
+    enum { NONE, KEY, VALUE, TARGET };
+    struct frame { bool arr, key; size_t idx; string name; };
+
+    void feed( const char* p, size_t n, string& o )
+    {
+	for( size_t i = 0; i < n; )
+	{
+	    if( _str != NONE )
+	    {
+		if( _esc ) { take( p + i, 1, o ); _esc = false; i++; continue; }
+		size_t j = scan( p, n, i, '"', '\\', '"' );
+		take( p + i, j - i, o ); i = j; if( i == n ) break;
+		if( p[i] == '\\' ) { take( p + i, 1, o ); _esc = true; i++; continue; }
+		finish( o ); i++; continue;
+	    }
+	    char c = p[i++];
+	    if( c == '"' )
+	    {
+		_buf.clear();
+		if( !_stack.empty() && !_stack.back().arr && _stack.back().key ) _str = KEY;
+		else _str = _ptrs.count( path() ) ? TARGET : VALUE;
+		if( _str != TARGET ) o += c;
+		continue;
+	    }
+	    o += c;
+	    if( c == '{' || c == '[' ) { frame f = { c == '[', true, 0, "" }; _stack.push_back( f ); }
+	    else if( ( c == '}' || c == ']' ) && !_stack.empty() ) _stack.pop_back();
+	    else if( c == ':' && !_stack.empty() ) _stack.back().key = false;
+	    else if( c == ',' && !_stack.empty() ) { if( _stack.back().arr ) _stack.back().idx++; else _stack.back().key = true; }
+	}
+    }
+
+    void take( const char* p, size_t n, string& o )
+    {
+	if( _str != TARGET ) o.append( p, n );
+	if( _str != VALUE ) _buf.append( p, n );
+    }
+
+    void finish( string& o )
     {
-	for( string::iterator si = t.begin(); si != t.end(); si++ )
+	if( _str == KEY ) _stack.back().name = unescape( _buf );
+	if( _str == TARGET )
 	{
-	    *si = toupper( *si ); if( *si < 65 || *si > 90 ) continue;
-	    if( *si == 'J' && ij ) *si = 'I';
-	    else if( *si == 'Q' && !ij ) continue;
-	    _txt += *si;
+	    string t = unescape( _buf ); _tmp.resize( basicPlayfair<A>::maxReady( t.length() ) );
+	    o += '"'; o.append( _tmp.data(), _ck.doIt( t.data(), t.length(), _e, _tmp.data() ) );
 	}
-	if( e )
+	o += '"'; _str = NONE;
+    }
+
+    // JSON pointer of the value about to start
+    string path() const
+    {
+	string r;
+	for( size_t x = 0; x < _stack.size(); x++ )
 	{
-	    string ntxt = ""; size_t len = _txt.length();
-	    for( size_t x = 0; x < len; x += 2 )
+	    r += '/';
+	    if( _stack[x].arr ) { r += to_string( _stack[x].idx ); continue; }
+	    for( string::const_iterator si = _stack[x].name.begin(); si != _stack[x].name.end(); si++ )
+		if( *si == '~' ) r += "~0"; else if( *si == '/' ) r += "~1"; else r += *si;
+	}
+	return r;
+    }
+
+    // decodes escapes, \u ones (surrogate pairs included) to UTF-8, so the ciphers
+    // transliterate an escaped letter like a raw one
+    static string unescape( const string& s )
+    {
+	string r;
+	for( size_t x = 0; x < s.length(); x++ )
+	{
+	    if( s[x] != '\\' || x + 1 >= s.length() ) { r += s[x]; continue; }
+	    char c = s[++x];
+	    if( c == 'u' && x + 4 < s.length() )
 	    {
-		ntxt += _txt[x];
-		if( x + 1 < len )
+		long u = strtol( s.substr( x + 1, 4 ).c_str(), 0, 16 ); x += 4;
+		if( u >= 0xd800 && u < 0xdc00 && x + 6 < s.length() && s[x + 1] == '\\' && s[x + 2] == 'u' )
 		{
-		    if( _txt[x] == _txt[x + 1] ) ntxt += 'X';
-		    ntxt += _txt[x + 1];
+		    long l = strtol( s.substr( x + 3, 4 ).c_str(), 0, 16 );
+		    if( l >= 0xdc00 && l < 0xe000 ) u = 0x10000 + ( ( u - 0xd800 ) << 10 ) + l - 0xdc00, x += 6;
 		}
+		utf8( u, r );
 	    }
-	    _txt = ntxt;
+	    else r += strchr( "bfnrt", c ) ? ' ' : c;
+	}
+	return r;
+    }
+
+    static void utf8( long u, string& r )
+    {
+	if( u < 0x80 ) r += char( u );
+	else if( u < 0x800 ) r += char( 0xc0 | u >> 6 ), r += char( 0x80 | ( u & 0x3f ) );
+	else if( u < 0x10000 ) r += char( 0xe0 | u >> 12 ), r += char( 0x80 | ( u >> 6 & 0x3f ) ), r += char( 0x80 | ( u & 0x3f ) );
+	else r += char( 0xf0 | u >> 18 ), r += char( 0x80 | ( u >> 12 & 0x3f ) ), r += char( 0x80 | ( u >> 6 & 0x3f ) ), r += char( 0x80 | ( u & 0x3f ) );
+    }
+
+    const basicKey<A>& _ck; bool _e; set<string> _ptrs;
+    int _str; bool _esc; string _buf; vector<char> _tmp; vector<frame> _stack;
+};
+ 
+template< class A > static int jsonMode( const string& key, const vector<string>& ptrs, bool ij, bool e )
+{
+    basicKey<A> ck( key, ij );
+    jsonCrypt<A>( ck, ptrs, e ).run( cin, cout );
+    return 0;
+}
+ 
+template< class A > static int csvMode( const string& key, const string& cols, bool ij, bool e, bool header, bool numa )
+{
+    basicKey<A> ck( key, ij ); unsigned threads = max( 1u, thread::hardware_concurrency() ); numaMap nm;
+    csvCrypt<A>( ck, cols, e, ',', header, numa ? &nm : 0 ).run( cin, cout, threads );
+    return 0;
+}
+ 
+// listens on a Unix socket path, or on 127.0.0.1:<port> when given a number
+static int listenOn( const string& where )
+{
+    int fd;
+    if( !where.empty() && where.find_first_not_of( "0123456789" ) == string::npos )
+    {
+	sockaddr_in a = sockaddr_in(); a.sin_family = AF_INET; a.sin_port = htons( atoi( where.c_str() ) );
+	a.sin_addr.s_addr = htonl( INADDR_LOOPBACK ); int one = 1;
+	fd = socket( AF_INET, SOCK_STREAM, 0 ); setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+	if( fd >= 0 && ::bind( fd, ( sockaddr* )&a, sizeof( a ) ) == 0 && listen( fd, 128 ) == 0 ) return fd;
+    }
+    else
+    {
+	sockaddr_un a = sockaddr_un(); a.sun_family = AF_UNIX;
+	strncpy( a.sun_path, where.c_str(), sizeof( a.sun_path ) - 1 ); unlink( where.c_str() );
+	fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( fd >= 0 && ::bind( fd, ( sockaddr* )&a, sizeof( a ) ) == 0 && listen( fd, 128 ) == 0 ) return fd;
+    }
+    cerr << "cannot listen on " << where << ": " << strerror( errno ) << endl;
+    if( fd >= 0 ) close( fd );
+    return -1;
+}
+ 
+// Daemon counters. Every worker thread owns a block that only it writes, with
+// plain relaxed stores, so counting costs no locked instructions; blocks are summed
+// only when the metrics endpoint is scraped. Counting is per request, never inside
+// the cipher loops.
+class daemonStats
+{
+public:
+    enum { ENC, DEC, ERRORS, KEY_HITS, KEY_MISSES, BYTES_IN, BYTES_OUT, BATCHES, BATCHED, SHED, COUNTERS, BATCH_BUCKETS = 12 };
+
+    struct alignas( 64 ) block
+    {
+	atomic<uint64_t> c[COUNTERS], batch[BATCH_BUCKETS]; latencyHistogram lat[STAGES];
+	void add( atomic<uint64_t>& a, uint64_t v ) { a.store( a.load( memory_order_relaxed ) + v, memory_order_relaxed ); }
+	void count( int x, uint64_t v = 1 ) { add( c[x], v ); }
+	void batchOf( size_t n )
+	{
+	    int b = 0; while( b + 1 < BATCH_BUCKETS && ( size_t( 1 ) << b ) < n ) b++;
+	    add( batch[b], 1 ); count( BATCHES ); count( BATCHED, n );
+	}
+    };
+
+    daemonStats() : _conns( 0 ) { clear( _gone ); }
+
+    block* attach()
+    {
+	block* b = new block; clear( *b );
+	lock_guard<mutex> l( _m ); _live.insert( b ); return b;
+    }
+
+    void detach( block* b )
+    {
+	lock_guard<mutex> l( _m ); _live.erase( b );
+	fold( *b, _gone ); delete b;
+    }
+
+    void connected( int d ) { _conns += d; }
+
+    // queued is the number of admitted requests not yet answered
+    string prometheus( size_t queued )
+    {
+	block t; clear( t );
+	{
+	    lock_guard<mutex> l( _m ); fold( _gone, t );
+	    for( set<block*>::iterator i = _live.begin(); i != _live.end(); i++ ) fold( **i, t );
 	}
-	if( _txt.length() & 1 ) _txt += 'X';
+	ostringstream o;
+	o << "# TYPE playfair_requests_total counter\n"
+	  << "playfair_requests_total{op=\"encrypt\"} " << t.c[ENC] << "\n"
+	  << "playfair_requests_total{op=\"decrypt\"} " << t.c[DEC] << "\n"
+	  << "# TYPE playfair_request_errors_total counter\nplayfair_request_errors_total " << t.c[ERRORS] << "\n"
+	  << "# TYPE playfair_key_lookups_total counter\n"
+	  << "playfair_key_lookups_total{result=\"hit\"} " << t.c[KEY_HITS] << "\n"
+	  << "playfair_key_lookups_total{result=\"miss\"} " << t.c[KEY_MISSES] << "\n"
+	  << "# TYPE playfair_bytes_total counter\n"
+	  << "playfair_bytes_total{dir=\"in\"} " << t.c[BYTES_IN] << "\n"
+	  << "playfair_bytes_total{dir=\"out\"} " << t.c[BYTES_OUT] << "\n"
+	  << "# TYPE playfair_shed_total counter\nplayfair_shed_total " << t.c[SHED] << "\n"
+	  << "# TYPE playfair_connections gauge\nplayfair_connections " << _conns << "\n"
+	  << "# TYPE playfair_queue_depth gauge\nplayfair_queue_depth " << queued << "\n"
+	  << "# TYPE playfair_batch_size histogram\n";
+	uint64_t cum = 0;
+	for( int b = 0; b < BATCH_BUCKETS; b++ )
+	{
+	    cum += t.batch[b];
+	    if( b + 1 < BATCH_BUCKETS ) o << "playfair_batch_size_bucket{le=\"" << ( 1 << b ) << "\"} " << cum << "\n";
+	}
+	o << "playfair_batch_size_bucket{le=\"+Inf\"} " << cum << "\n"
+	  << "playfair_batch_size_sum " << t.c[BATCHED] << "\n"
+	  << "playfair_batch_size_count " << t.c[BATCHES] << "\n"
+	  << "# TYPE playfair_latency_seconds summary\n";
+	const double qs[] = { .5, .9, .99, .999 };
+	for( int x = 0; x < STAGES; x++ )
+	{
+	    if( !t.lat[x].count() ) continue;
+	    for( int q = 0; q < 4; q++ )
+		o << "playfair_latency_seconds{stage=\"" << stageNames[x] << "\",quantile=\"" << qs[q] << "\"} " << t.lat[x].percentile( qs[q] ) / 1e9 << "\n";
+	    o << "playfair_latency_seconds_sum{stage=\"" << stageNames[x] << "\"} " << t.lat[x].sum() / 1e9 << "\n"
+	      << "playfair_latency_seconds_count{stage=\"" << stageNames[x] << "\"} " << t.lat[x].count() << "\n";
+	}
+	return o.str();
     }
+
+private:
+    static void clear( block& b )
+    {
+	for( int x = 0; x < COUNTERS; x++ ) b.c[x] = 0;
+	for( int x = 0; x < BATCH_BUCKETS; x++ ) b.batch[x] = 0;
+	for( int x = 0; x < STAGES; x++ ) b.lat[x].clear();
+    }
+
+    static void fold( const block& f, block& t )
+    {
+	for( int x = 0; x < COUNTERS; x++ ) t.c[x] += f.c[x].load( memory_order_relaxed );
+	for( int x = 0; x < BATCH_BUCKETS; x++ ) t.batch[x] += f.batch[x].load( memory_order_relaxed );
+	for( int x = 0; x < STAGES; x++ ) t.lat[x].merge( f.lat[x] );
+    }
+
+    mutex _m; set<block*> _live; block _gone; atomic<int> _conns;
+};
  
-    void createGrid( string k, bool ij )
+// line protocol over a Unix socket: "E <name> <text>" or "D <name> <text>" is
+// answered by the ciphertext or "ERR <reason>". Keys come from a file of
+// "name<TAB>key" lines (a third "q" field drops Q) and are reloaded on SIGHUP
+// without pausing requests in flight.
+//
+// Connection threads only read: request lines are cut into jobs and queued per
+// client, and a fixed pool of workers serves the clients with work round-robin,
+// one job per turn, so a flooding client cannot starve the rest. Admission is
+// bounded twice: by a high/low watermark on requests queued overall and by a
+// per-client limit. Over either, a client is held back (it stops being read, so
+// the socket pushes back on it) or, with shedding on, its requests are answered
+// "ERR overloaded" in order without being queued.
+//
+// Given a numaMap, worker w is pinned to node nodeOf( w ) and reads a registry
+// of keys compiled on that node.
+class cipherDaemon
+{
+public:
+    cipherDaemon( const string& keyfile, size_t high, size_t low, size_t perClient, bool shed, const numaMap* numa = 0 ) :
+	_keyfile( keyfile ), _numa( numa ), _keys( numa ? numa->nodes() : 1 ), _stop( false ), _quit( false ), _high( max( high, size_t( 1 ) ) ), _low( min( low, _high - 1 ) ),
+	_perClient( max( perClient, size_t( 1 ) ) ), _shed( shed ), _full( false ), _queued( 0 )
+    {
+	for( size_t n = 0; n < _keys.size(); n++ ) _keys[n].reset( new registry );
+    }
+
+    // metrics, when given, is where Prometheus text is served over HTTP
+    int run( const string& path, const string& metrics )
+    {
+	if( !load() ) return 1;
+	sigset_t sigs; sigemptyset( &sigs ); sigaddset( &sigs, SIGHUP ); sigaddset( &sigs, SIGINT ); sigaddset( &sigs, SIGTERM );
+	pthread_sigmask( SIG_BLOCK, &sigs, 0 ); signal( SIGPIPE, SIG_IGN );
+	int fd = listenOn( path ), mfd = metrics.empty() ? -1 : listenOn( metrics );
+	if( fd < 0 || ( !metrics.empty() && mfd < 0 ) ) return 1;
+	thread sig( [&]() { signals( sigs, fd, mfd ); } ), scrape; vector<thread> pool;
+	for( unsigned w = min( max( thread::hardware_concurrency(), 1u ), 64u ); w--; ) pool.push_back( thread( [this, w]() { work( w ); } ) );
+	if( mfd >= 0 ) scrape = thread( [&]() { serveMetrics( mfd ); } );
+	for( int c; ( c = accept( fd, 0, 0 ) ) >= 0 || errno == EINTR; )
+	{
+	    if( c < 0 ) continue;
+	    lock_guard<mutex> l( _m ); _conns.insert( c ); _stats.connected( 1 );
+	    thread( [this, c]() { serve( c ); lock_guard<mutex> l( _m ); _conns.erase( c ); close( c ); _stats.connected( -1 ); _done.notify_all(); } ).detach();
+	}
+	_stop = true; sig.join(); close( fd ); unlink( path.c_str() );
+	if( scrape.joinable() ) { scrape.join(); close( mfd ); unlink( metrics.c_str() ); }
+	{ lock_guard<mutex> l( _qm ); _room.notify_all(); }
+	{
+	    unique_lock<mutex> l( _m );
+	    for( set<int>::iterator i = _conns.begin(); i != _conns.end(); i++ ) shutdown( *i, SHUT_RDWR );
+	    _done.wait( l, [this]() { return _conns.empty(); } );
+	}
+	{ lock_guard<mutex> l( _qm ); _quit = true; _work.notify_all(); }
+	for( size_t w = 0; w < pool.size(); w++ ) pool[w].join();
+	return 0;
+    }
+
+private:
+    typedef keyRegistry<compiledKey> registry;
+    enum { JOB_LINES = 256, OUT_MAX = 1 << 20, MAX_LINE = 1 << 20 };
+
+    // n request lines, or with shed set only the count of requests to refuse
+    struct job { string lines; size_t n; bool shed; };
+
+    // busy while a worker holds one of its jobs; in _ring whenever idle with jobs and
+    // not stalled, which it is while OUT_MAX answers wait for its writer to send them
+    struct client { int fd; deque<job> q; size_t queued; bool busy, dead, stalled, closing; string out; condition_variable flush; };
+
+    bool load()
+    {
+	ifstream f( _keyfile.c_str() ); if( !f ) { cerr << "cannot open " << _keyfile << endl; return false; }
+	vector< pair< string, pair<string, bool> > > rows; string line;
+	while( getline( f, line ) )
+	{
+	    istringstream l( line ); string name, key, q;
+	    if( !getline( l, name, '\t' ) || !getline( l, key, '\t' ) || name.empty() ) continue;
+	    getline( l, q ); rows.push_back( make_pair( name, make_pair( key, q != "q" ) ) );
+	}
+	for( size_t n = 0; n < _keys.size(); n++ )
+	{
+	    function<void()> build = [&]() {
+		unique_ptr<registry::snapshot> s( new registry::snapshot );
+		for( size_t x = 0; x < rows.size(); x++ ) ( *s )[rows[x].first] = make_shared<const compiledKey>( rows[x].second.first, rows[x].second.second );
+		_keys[n]->publish( s.release() );
+	    };
+	    if( _numa ) thread( [&]() { _numa->pin( n ); build(); } ).join();
+	    else build();
+	}
+	return true;
+    }
+
+    void serveMetrics( int fd )
+    {
+	char req[4096];
+	for( int c; ( c = accept( fd, 0, 0 ) ) >= 0 || errno == EINTR; )
+	{
+	    if( c < 0 ) continue;
+	    if( recv( c, req, sizeof( req ), 0 ) > 0 )
+	    {
+		string body = _stats.prometheus( _queued );
+		sendAll( c, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + to_string( body.length() ) + "\r\n\r\n" + body );
+	    }
+	    close( c );
+	}
+    }
+
+    void signals( const sigset_t& sigs, int fd, int mfd )
+    {
+	timespec t = { 0, 100000000 };
+	while( !_stop )
+	{
+	    int s = sigtimedwait( &sigs, 0, &t );
+	    if( s == SIGHUP ) { if( load() ) cerr << "keys reloaded" << endl; }
+	    else if( s == SIGINT || s == SIGTERM ) { _stop = true; shutdown( fd, SHUT_RDWR ); if( mfd >= 0 ) shutdown( mfd, SHUT_RDWR ); }
+	    for( size_t n = 0; n < _keys.size(); n++ ) _keys[n]->reclaim();
+	}
+    }
+
+    // reads requests off one connection, with a writer thread sending the answers;
+    // returns once all its jobs are answered and sent. A line over MAX_LINE bytes is
+    // answered ERR too long after the ones before it, and ends the connection
+    void serve( int c )
+    {
+	shared_ptr<client> cl( new client ); cl->fd = c; cl->queued = 0; cl->busy = cl->dead = cl->stalled = cl->closing = false;
+	thread wr( [this, cl]() { drain( cl ); } ); string in; vector<char> buf( 1 << 16 ); bool ok = true, longLine = false;
+	for( ssize_t n; ok && !longLine && ( n = recv( c, buf.data(), buf.size(), 0 ) ) > 0; )
+	{
+	    in.append( buf.data(), n ); size_t s = 0, e = s, nl, lines = 0;
+	    for( ; ok && ( nl = in.find( '\n', e ) ) != string::npos; e = nl + 1 )
+		if( ++lines == JOB_LINES ) { ok = submit( cl, in.substr( s, nl + 1 - s ), lines ); s = nl + 1; lines = 0; }
+	    if( ok && lines ) ok = submit( cl, in.substr( s, e - s ), lines );
+	    in.erase( 0, e ); longLine = in.length() > MAX_LINE;
+	}
+	{
+	    unique_lock<mutex> l( _qm ); _room.wait( l, [&]() { return cl->q.empty() && !cl->busy; } );
+	    if( longLine && !cl->dead ) cl->out += "ERR too long\n";
+	    cl->closing = true; cl->flush.notify_one();
+	}
+	wr.join();
+    }
+
+    // sends what the workers leave in cl->out, so that a peer that does not read
+    // blocks only this thread; a failed send drops the client's queued jobs
+    void drain( const shared_ptr<client>& cl )
+    {
+	unique_lock<mutex> l( _qm ); string s;
+	for( ;; )
+	{
+	    cl->flush.wait( l, [&]() { return !cl->out.empty() || cl->closing; } );
+	    if( cl->out.empty() ) return;
+	    s.swap( cl->out );
+	    if( cl->stalled ) { cl->stalled = false; if( !cl->busy && !cl->q.empty() ) { _ring.push_back( cl ); _work.notify_one(); } }
+	    l.unlock(); bool sent = sendAll( cl->fd, s ); s.clear(); l.lock();
+	    if( !sent && !cl->dead )
+	    {
+		cl->dead = true; cl->out.clear(); shutdown( cl->fd, SHUT_RDWR );
+		for( ; !cl->q.empty(); cl->q.pop_front() ) if( !cl->q.front().shed ) release( *cl, cl->q.front().n );
+		_ring.erase( remove( _ring.begin(), _ring.end(), cl ), _ring.end() ); _room.notify_all();
+	    }
+	}
+    }
+
+    // admits one job, waiting for room unless shedding; false once the daemon stops.
+    // A client with nothing queued gets in past a full queue, so clients that fill it
+    // and stop reading their answers cannot lock the others out
+    bool submit( const shared_ptr<client>& cl, string lines, size_t n )
+    {
+	unique_lock<mutex> l( _qm );
+	if( _shed && ( ( _full && cl->queued ) || cl->queued >= _perClient ) )
+	{
+	    if( cl->q.empty() || !cl->q.back().shed ) cl->q.push_back( job { string(), 0, true } );
+	    cl->q.back().n += n;
+	}
+	else
+	{
+	    _room.wait( l, [&]() { return _stop || cl->dead || ( ( !_full || !cl->queued ) && cl->queued < _perClient ); } );
+	    if( _stop || cl->dead ) return false;
+	    cl->q.push_back( job { move( lines ), n, false } ); cl->queued += n;
+	    if( ( _queued += n ) >= _high ) _full = true;
+	}
+	if( !cl->busy && !cl->stalled && cl->q.size() == 1 ) { _ring.push_back( cl ); _work.notify_one(); }
+	return true;
+    }
+
+    void work( unsigned w )
+    {
+	size_t node = _numa ? _numa->nodeOf( w ) : 0;
+	if( _numa ) _numa->pin( node );
+	registry::reader r( *_keys[node] ); string out; vector<char> tmp;
+	unique_ptr< daemonStats::block, function<void( daemonStats::block* )> > st( _stats.attach(), [this]( daemonStats::block* b ) { _stats.detach( b ); } );
+	unique_lock<mutex> l( _qm );
+	for( ;; )
+	{
+	    _work.wait( l, [this]() { return !_ring.empty() || _quit; } );
+	    if( _ring.empty() ) return;
+	    shared_ptr<client> cl = _ring.front(); _ring.pop_front();
+	    if( cl->dead || cl->q.empty() ) continue;
+	    job j = move( cl->q.front() ); cl->q.pop_front(); cl->busy = true;
+	    l.unlock(); out.clear();
+	    if( j.shed ) { for( size_t x = 0; x < j.n; x++ ) out += "ERR overloaded\n"; st->count( daemonStats::SHED, j.n ); }
+	    else if( !r.ok() ) for( size_t x = 0; x < j.n; x++ ) out += "ERR busy\n";
+	    else
+	    {
+		for( size_t s = 0, nl; ( nl = j.lines.find( '\n', s ) ) != string::npos; s = nl + 1 ) request( r, *st, j.lines.data() + s, nl - s, tmp, out );
+		st->batchOf( j.n );
+	    }
+	    l.lock(); cl->busy = false;
+	    if( !j.shed ) release( *cl, j.n );
+	    if( !cl->dead ) { cl->out += out; cl->flush.notify_one(); cl->stalled = cl->out.length() >= OUT_MAX; }
+	    if( !cl->q.empty() && !cl->stalled ) _ring.push_back( cl );
+	    _room.notify_all();
+	}
+    }
+
+    void release( client& cl, size_t n )
+    {
+	cl.queued -= n; _queued -= n;
+	if( _full && _queued <= _low ) _full = false;
+    }
+
+    void request( registry::reader& r, daemonStats::block& st, const char* p, size_t n, vector<char>& tmp, string& out )
+    {
+	const char* sp = n > 2 ? ( const char* )memchr( p + 2, ' ', n - 2 ) : 0; uint64_t t0 = nowNs(), t1, t2, t3, t4;
+	st.count( daemonStats::BYTES_IN, n + 1 );
+	if( !sp || ( p[0] != 'E' && p[0] != 'D' ) || p[1] != ' ' ) { st.count( daemonStats::ERRORS ); out += "ERR bad request\n"; return; }
+	const registry::snapshot& keys = r.enter();
+	registry::snapshot::const_iterator k = keys.find( string( p + 2, sp ) );
+	if( k == keys.end() )
+	{
+	    r.exit(); st.count( daemonStats::KEY_MISSES ); st.count( daemonStats::ERRORS );
+	    out += "ERR unknown key\n"; return;
+	}
+	size_t len = n - ( sp + 1 - p ); tmp.resize( playfair::maxReady( len ) ); t1 = nowNs();
+	len = k->second->prepare( sp + 1, len, p[0] == 'E', tmp.data() ); t2 = nowNs();
+	k->second->crypt( tmp.data(), tmp.data(), len, p[0] == 'E' ); r.exit(); t3 = nowNs();
+	out.append( tmp.data(), len ) += '\n'; t4 = nowNs();
+	st.count( daemonStats::KEY_HITS ); st.count( p[0] == 'E' ? daemonStats::ENC : daemonStats::DEC );
+	st.count( daemonStats::BYTES_OUT, len + 1 );
+	st.lat[ST_LOOKUP].record( t1 - t0 ); st.lat[ST_NORMALIZE].record( t2 - t1 ); st.lat[ST_CIPHER].record( t3 - t2 );
+	st.lat[ST_OUTPUT].record( t4 - t3 ); st.lat[ST_REQUEST].record( t4 - t0 );
+    }
+
+    static bool sendAll( int c, const string& s )
     {
-	if( k.length() < 1 ) k = "KEYWORD"; 
-	k += "ABCDEFGHIJKLMNOPQRSTUVWXYZ"; string nk = "";
-	for( string::iterator si = k.begin(); si != k.end(); si++ )
+	for( size_t o = 0; o < s.length(); )
 	{
-	    *si = toupper( *si ); if( *si < 65 || *si > 90 ) continue;
-	    if( ( *si == 'J' && ij ) || ( *si == 'Q' && !ij ) )continue;
-	    if( nk.find( *si ) == -1 ) nk += *si;
+	    ssize_t n = send( c, s.data() + o, s.length() - o, 0 ); if( n <= 0 ) return false;
+	    o += n;
 	}
-	copy( nk.begin(), nk.end(), &_m[0][0] );
+	return true;
     }
+
+    string _keyfile; const numaMap* _numa; vector< unique_ptr<registry> > _keys; atomic<bool> _stop; bool _quit; daemonStats _stats;
+    mutex _m; condition_variable _done; set<int> _conns;
+    mutex _qm; condition_variable _work, _room; deque< shared_ptr<client> > _ring;
+    size_t _high, _low, _perClient; bool _shed, _full; atomic<size_t> _queued;
+};
  
-    string _txt; char _m[5][5];
+static int bytesMode( const string& key, istream& in, ostream& out, bool e )
+{
+    unique_ptr< basicKey<alpha256> > ck( new basicKey<alpha256>( key, false ) ); vector<char> buf( 1 << 20 );
+    while( in.read( buf.data(), buf.size() ) || in.gcount() )
+    {
+	size_t n = in.gcount(); ck->crypt( buf.data(), buf.data(), n, e );
+	out.write( buf.data(), n );
+    }
+    return 0;
+}
+ 
+// --detect: one blob per input line, one Playfair confidence per output line. Input
+// is taken in 16 MiB blocks of whole lines, each split by lines across the cores.
+static int detectMode( istream& in, ostream& out )
+{
+    const size_t block = 16 << 20; unsigned threads = max( thread::hardware_concurrency(), 1u );
+    vector<playfairDetector> det( threads ); vector<string> res( threads ); string buf; size_t keep = 0;
+    for( bool last = false; !last; )
+    {
+	buf.resize( keep + block ); in.read( &buf[keep], block ); buf.resize( keep + in.gcount() ); last = !in;
+	size_t n = buf.size(), end = n;
+	if( !last ) { end = buf.rfind( '\n', n - 1 ); end = end == string::npos ? 0 : end + 1; }
+	vector<size_t> lines( 1, 0 );
+	for( size_t i = 0; ( i = scan( buf.data(), end, i, '\n', '\n', '\n' ) ) < end; ) lines.push_back( ++i );
+	if( end && buf[end - 1] != '\n' ) lines.push_back( end );
+	vector<thread> pool; size_t per = ( lines.size() - 1 + threads - 1 ) / threads;
+	for( unsigned t = 0; t < threads; t++ )
+	    pool.push_back( thread( [&, t]() {
+		char s[16]; res[t].clear();
+		for( size_t x = t * per; x < min( ( t + 1 ) * per, lines.size() - 1 ); x++ )
+		    res[t].append( s, snprintf( s, sizeof( s ), "%.3f\n", det[t].score( buf.data() + lines[x], lines[x + 1] - lines[x] ) ) );
+	    } ) );
+	for( unsigned t = 0; t < threads; t++ ) { pool[t].join(); out << res[t]; }
+	buf.erase( 0, end ); keep = buf.size();
+    }
+    return 0;
+}
+ 
+// --histogram: the letter and digraph counts of all the letters of the input as one
+// stream, written as a binary freqTable. Input is taken in 16 MiB blocks whose codes
+// are cut into parts of even length, counted on the cores by counters of their own
+// and merged at the end.
+static int histogramMode( istream& in, ostream& out )
+{
+    const size_t block = 16 << 20; unsigned threads = max( thread::hardware_concurrency(), 1u );
+    vector<digraphCounter> cnt( threads ); vector<freqTable> part( threads );
+    vector<char> buf( block ); vector<unsigned char> codes; size_t keep = 0;
+    for( bool last = false; !last; )
+    {
+	in.read( buf.data(), block ); size_t got = in.gcount(), other; last = !in;
+	codes.resize( keep + got + 16 ); size_t n = keep + letterCodes( buf.data(), got, codes.data() + keep, other );
+	// while more follows, the last one or two codes wait for the next block, so
+	// every part starts at an even position and has the letter after it
+	size_t m = last ? n : n < 2 ? 0 : ( n - 1 ) & ~size_t( 1 ), per = ( ( m + threads - 1 ) / threads + 1 ) & ~size_t( 1 );
+	vector<thread> pool;
+	for( unsigned t = 0; t < threads; t++ )
+	    pool.push_back( thread( [&, t]() {
+		size_t s = min( t * per, m ), e = min( s + per, m );
+		cnt[t].add( codes.data() + s, e - s, e < n ); cnt[t].flush( part[t] );
+	    } ) );
+	for( unsigned t = 0; t < threads; t++ ) pool[t].join();
+	memmove( codes.data(), codes.data() + m, keep = n - m );
+    }
+    for( unsigned t = 1; t < threads; t++ ) part[0].merge( part[t] );
+    out.write( ( const char* )&part[0], sizeof( freqTable ) );
+    return 0;
+}
+ 
+// Chosen-plaintext key lookup: every keyword of a wordlist enciphers a fixed probe,
+// and the 64-bit hash of the ciphertext letters leads back to the keyword. Keywords
+// whose grids are equivalent (the same up to cyclic shifts of rows and columns)
+// encipher alike and are kept once, the first in the wordlist winning; distinct
+// grids that happen to agree on the probe all stay, and a lookup returns each. The
+// file is a header, an open-addressed table of slots (linear probing, fingerprint 0
+// marking a free slot) and the keywords, NUL-terminated; it is mapped read-only, so
+// a lookup is a hash and a probe or two into the page cache.
+class keyIndex
+{
+public:
+    enum { PROBE_MAX = 256 };
+    struct header { char magic[8]; uint64_t slots, keys, bytes; char probe[PROBE_MAX]; };
+    struct slot { uint64_t fp, word; };
+
+    // the fingerprint of a ciphertext: its letters, upper case, hashed
+    static uint64_t fingerprint( const char* p, size_t n )
+    {
+	string l;
+	for( size_t i = 0; i < n; i++ ) if( isalpha( ( unsigned char )p[i] ) ) l += toupper( p[i] );
+	uint64_t h = hashBytes( l.data(), l.length(), 0 );
+	return h ? h : 1;
+    }
+
+    // enciphers probe under every line of words on the cores and writes the index
+    static bool build( const string& words, const string& file, const string& probe, bool ij )
+    {
+	ifstream in( words.c_str() ); if( !in ) { cerr << "cannot open " << words << endl; return false; }
+	if( probe.length() >= PROBE_MAX ) { cerr << "probe longer than " << PROBE_MAX - 1 << " bytes" << endl; return false; }
+	vector<string> w; string l;
+	while( getline( in, l ) ) { if( !l.empty() && l.back() == '\r' ) l.pop_back(); if( !l.empty() ) w.push_back( l ); }
+
+	// per keyword the fingerprint and a hash of the grid turned so that A is top
+	// left, which equivalent grids share
+	struct entry { uint64_t fp, grid; size_t word; };
+	unsigned threads = max( thread::hardware_concurrency(), 1u ); vector<entry> e( w.size() ); vector<thread> pool;
+	string txt = playfair::getTextReady( probe, ij, true );
+	for( unsigned t = 0; t < threads; t++ )
+	    pool.push_back( thread( [&, t]() {
+		playfair pf; const playfair& k = pf; string out( txt.length(), ' ' ); char m[playfair::CELLS], g[playfair::CELLS];
+		for( size_t x = t; x < w.size(); x += threads )
+		{
+		    playfair::createGrid( w[x], ij, m ); int a = std::find( m, m + playfair::CELLS, 'A' ) - m;
+		    for( int y = 0; y < playfair::CELLS; y++ )
+			g[y] = m[( y / playfair::COLS + a / playfair::COLS ) % playfair::ROWS * playfair::COLS + ( y + a ) % playfair::COLS];
+		    pf.setKey( w[x], ij ); k.doIt( txt.data(), &out[0], txt.length(), 1 );
+		    e[x] = entry { fingerprint( out.data(), out.length() ), hashBytes( g, sizeof( g ), 0 ), x };
+		}
+	    } ) );
+	for( unsigned t = 0; t < threads; t++ ) pool[t].join();
+	sort( e.begin(), e.end(), []( const entry& a, const entry& b ) { return a.grid < b.grid || ( a.grid == b.grid && a.word < b.word ); } );
+	e.erase( unique( e.begin(), e.end(), []( const entry& a, const entry& b ) { return a.grid == b.grid; } ), e.end() );
+	sort( e.begin(), e.end(), []( const entry& a, const entry& b ) { return a.word < b.word; } );
+
+	// at most half full; the slots name the words by their offset in the blob
+	header h = header(); memcpy( h.magic, "PFINDEX1", 8 ); strcpy( h.probe, probe.c_str() );
+	h.keys = e.size(); h.slots = 16; while( h.slots < 2 * h.keys ) h.slots *= 2;
+	vector<slot> table( h.slots, slot { 0, 0 } ); string blob;
+	for( size_t x = 0; x < e.size(); x++ )
+	{
+	    size_t i = e[x].fp & ( h.slots - 1 );
+	    while( table[i].fp ) i = ( i + 1 ) & ( h.slots - 1 );
+	    table[i] = slot { e[x].fp, blob.length() }; blob += w[e[x].word]; blob += '\0';
+	}
+	h.bytes = blob.length();
+	ofstream o( file.c_str(), ios::binary );
+	o.write( ( const char* )&h, sizeof( h ) ).write( ( const char* )table.data(), h.slots * sizeof( slot ) ).write( blob.data(), blob.length() );
+	if( !o.flush() ) { cerr << "cannot write " << file << endl; return false; }
+	cerr << w.size() << " keywords, " << h.keys << " distinct grids" << endl;
+	return true;
+    }
+
+    keyIndex( const string& file ) : _map( MAP_FAILED ), _size( 0 )
+    {
+	int fd = open( file.c_str(), O_RDONLY ); struct stat st;
+	if( fd < 0 || fstat( fd, &st ) || size_t( st.st_size ) < sizeof( header ) ) { if( fd >= 0 ) close( fd ); return; }
+	_map = mmap( 0, _size = st.st_size, PROT_READ, MAP_SHARED, fd, 0 ); close( fd );
+	if( _map == MAP_FAILED ) return;
+	if( !valid() ) { munmap( _map, _size ); _map = MAP_FAILED; }
+    }
+    ~keyIndex() { if( _map != MAP_FAILED ) munmap( _map, _size ); }
+
+    bool ok() const { return _map != MAP_FAILED; }
+    const char* probe() const { return ( ( const header* )_map )->probe; }
+
+    // the keywords that encipher the probe as c[0, n), in wordlist order
+    vector<const char*> find( const char* c, size_t n ) const
+    {
+	const header* h = ( const header* )_map; const slot* table = ( const slot* )( h + 1 );
+	const char* words = ( const char* )( table + h->slots ); uint64_t f = fingerprint( c, n ); vector<const char*> r;
+	for( size_t i = f & ( h->slots - 1 ); table[i].fp; i = ( i + 1 ) & ( h->slots - 1 ) )
+	    if( table[i].fp == f ) r.push_back( words + table[i].word );
+	return r;
+    }
+
+private:
+    // a file find can walk safely: sizes that add up, a power-of-two table with
+    // free slots, used slots naming the starts of NUL-terminated words
+    bool valid() const
+    {
+	const header* h = ( const header* )_map; size_t room = ( _size - sizeof( header ) ) / sizeof( slot );
+	if( memcmp( h->magic, "PFINDEX1", 8 ) || !memchr( h->probe, 0, PROBE_MAX ) ) return false;
+	if( h->slots < 2 || h->slots & ( h->slots - 1 ) || h->slots > room || h->keys >= h->slots ) return false;
+	if( sizeof( header ) + h->slots * sizeof( slot ) + h->bytes != _size ) return false;
+	const slot* table = ( const slot* )( h + 1 ); const char* words = ( const char* )( table + h->slots ); size_t used = 0;
+	if( h->bytes && words[h->bytes - 1] ) return false;
+	for( size_t i = 0; i < h->slots; i++ )
+	    if( table[i].fp && ( ++used > h->keys || table[i].word >= h->bytes || ( table[i].word && words[table[i].word - 1] ) ) ) return false;
+	return used == h->keys;
+    }
+
+    void* _map; size_t _size;
 };
  
+// --lookup: one ciphertext of the index's probe per input line, the keywords behind
+// it per output line, tab-separated, or - if none
+static int lookupMode( const string& file )
+{
+    keyIndex ix( file ); if( !ix.ok() ) { cerr << "cannot map index " << file << endl; return 1; }
+    for( string c; getline( cin, c ); )
+    {
+	vector<const char*> k = ix.find( c.data(), c.length() );
+	if( k.empty() ) cout << "-";
+	for( size_t x = 0; x < k.size(); x++ ) cout << ( x ? "\t" : "" ) << k[x];
+	cout << '\n';
+    }
+    return 0;
+}
+ 
+template< class A > static int sweepMode( const string& file, bool ij, bool e )
+{
+    ifstream f( file.c_str() ); if( !f ) { cerr << "cannot open " << file << endl; return 1; }
+    basicSweep<A> ks( ij ); vector<string> keys; string k, txt;
+    while( getline( f, k ) ) if( !k.empty() ) { ks.addKey( k ); keys.push_back( k ); }
+    while( getline( cin, txt ) )
+    {
+	vector<string> r = ks.doIt( txt, e );
+	for( size_t x = 0; x < r.size(); x++ ) cout << keys[x] << '\t' << r[x] << '\n';
+    }
+    return 0;
+}
+ 
 int main( int argc, char* argv[] )
 {
     string key, i, txt; bool ij, e;
+    if( argc > 1 )
+    {
+	vector<string> args; ij = true; e = true; bool an = false, format = false, unfill = false, pad = false, stats = false, shed = false, numa = false, header = true; size_t cache = 0, high = 0, low = 0, perClient = 0; codec z = RAW;
+	for( int a = 1; a < argc; a++ )
+	    if( !strcmp( argv[a], "-d" ) ) e = false;
+	    else if( !strcmp( argv[a], "--stats" ) ) stats = true;
+	    else if( !strcmp( argv[a], "-c" ) && a + 1 < argc ) cache = strtoul( argv[++a], 0, 10 );
+	    else if( !strcmp( argv[a], "--queue" ) && a + 1 < argc )
+	    {
+		char* end; high = strtoul( argv[++a], &end, 10 ); low = *end == ':' ? strtoul( end + 1, 0, 10 ) : high / 2;
+	    }
+	    else if( !strcmp( argv[a], "--client" ) && a + 1 < argc ) perClient = strtoul( argv[++a], 0, 10 );
+	    else if( !strcmp( argv[a], "--shed" ) ) shed = true;
+	    else if( !strcmp( argv[a], "--numa" ) ) numa = true;
+	    else if( !strcmp( argv[a], "--no-header" ) ) header = false;
+	    else if( !strcmp( argv[a], "--gzip" ) ) z = GZIP;
+	    else if( !strcmp( argv[a], "--zstd" ) ) z = ZSTD;
+	    else if( !strcmp( argv[a], "-q" ) ) ij = false;
+	    else if( !strcmp( argv[a], "-6" ) ) an = true;
+	    else if( !strcmp( argv[a], "-f" ) ) format = true;
+	    else if( !strcmp( argv[a], "-u" ) ) unfill = pad = true;
+	    else if( !strcmp( argv[a], "-U" ) ) unfill = true;
+	    else args.push_back( argv[a] );
+#ifndef PLAYFAIR_ZLIB
+	if( z == GZIP ) { cerr << "built without zlib" << endl; return 1; }
+#endif
+#ifndef PLAYFAIR_ZSTD
+	if( z == ZSTD ) { cerr << "built without zstd" << endl; return 1; }
+#endif
+	if( args.size() == 2 && args[0] == "--sweep" ) return an ? sweepMode<alpha36>( args[1], ij, e ) : sweepMode<alpha25>( args[1], ij, e );
+	if( ( args.size() == 2 && args[0] == "--bulk" ) || ( args.size() == 3 && ( args[0] == "--two" || args[0] == "--four" ) ) )
+	{
+	    if( !high ) high = 4, low = 2;
+	    if( unfill && ( e || format ) ) { cerr << "-u and -U need -d and no -f" << endl; return 1; }
+	    if( cache && format ) { cerr << "-c needs no -f" << endl; return 1; }
+	    return fileMode( z, [&]( istream& in, ostream& out ) {
+		return an ? bulkMode<alpha36>( args, in, out, ij, e, format, unfill, pad, cache, stats, high, low ) : bulkMode<alpha25>( args, in, out, ij, e, format, unfill, pad, cache, stats, high, low );
+	    } );
+	}
+	if( ( args.size() == 3 || args.size() == 4 ) && args[0] == "--daemon" )
+	{
+	    if( !high ) high = 4096, low = 2048;
+	    numaMap nm;
+	    return cipherDaemon( args[2], high, low, perClient ? perClient : high / 4, shed, numa ? &nm : 0 ).run( args[1], args.size() == 4 ? args[3] : "" );
+	}
+	if( ( args.size() == 3 || args.size() == 4 ) && args[0] == "--index" )
+	    return keyIndex::build( args[1], args[2], args.size() == 4 ? args[3] : "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG", ij ) ? 0 : 1;
+	if( args.size() == 2 && args[0] == "--lookup" ) return lookupMode( args[1] );
+	if( args.size() == 1 && args[0] == "--histogram" ) return fileMode( z, [&]( istream& in, ostream& out ) { return histogramMode( in, out ); } );
+	if( args.size() == 1 && args[0] == "--detect" ) return fileMode( z, [&]( istream& in, ostream& out ) { return detectMode( in, out ); } );
+	if( args.size() == 2 && args[0] == "--bytes" ) return fileMode( z, [&]( istream& in, ostream& out ) { return bytesMode( args[1], in, out, e ); }, false );
+	if( args.size() >= 3 && args[0] == "--json" )
+	{
+	    vector<string> ptrs( args.begin() + 2, args.end() );
+	    return an ? jsonMode<alpha36>( args[1], ptrs, ij, e ) : jsonMode<alpha25>( args[1], ptrs, ij, e );
+	}
+	if( args.size() == 3 && args[0] == "--csv" ) return an ? csvMode<alpha36>( args[1], args[2], ij, e, header, numa ) : csvMode<alpha25>( args[1], args[2], ij, e, header, numa );
+	cerr << "usage: " << argv[0] << " [-d] [-q] [-6] [-f] [-u|-U] [-c <entries>] [--stats] [--gzip|--zstd] --sweep <keyfile> | --bulk <key> | --two <key1> <key2> | --four <key1> <key2> | --bytes <key> | --detect | --histogram | --index <wordlist> <index> [<probe>] | --lookup <index> | [--no-header] --csv <key> <cols> | --json <key> <pointer>... | --daemon <socket> <keyfile> [<metrics socket|port>]" << endl; return 1;
+    }
     cout << "(E)ncode or (D)ecode? "; getline( cin, i ); e = ( i[0] == 'e' || i[0] == 'E' );
     cout << "Enter a en/decryption key: "; getline( cin, key ); 
     cout << "I <-> J (Y/N): "; getline( cin, i ); ij = ( i[0] == 'y' || i[0] == 'Y' );
@@ -0,0 +1,1258 @@
+#ifndef PLAYFAIR_H
+#define PLAYFAIR_H
+ 
+#include <bits/stdc++.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#if __has_include( <sys/mman.h> )
+#include <sys/mman.h>
+#endif
+ 
+using namespace std;
+ 
+// An alphabet describes a ROWS x COLS grid over the symbol codes [BASE, BASE + DOMAIN):
+// grid() maps a key byte to a grid symbol, fold() maps a text byte to one, both
+// returning -1 to drop it, and symbols() lists the grid fill order. LATIN alphabets
+// read text as UTF-8, accented Latin letters standing for their plain ones.
+struct alpha25
+{
+    enum { ROWS = 5, COLS = 5, BASE = 'A', DOMAIN = 26, FILLER = 'X', LATIN = 1 };
+    static int grid( char c, bool ij )
+    {
+	c = toupper( c ); if( c < 65 || c > 90 ) return -1;
+	if( ( c == 'J' && ij ) || ( c == 'Q' && !ij ) ) return -1;
+	return c;
+    }
+    static int fold( char c, bool ij )
+    {
+	c = toupper( c ); if( c < 65 || c > 90 ) return -1;
+	if( c == 'J' && ij ) return 'I';
+	if( c == 'Q' && !ij ) return -1;
+	return c;
+    }
+    static string symbols() { return "ABCDEFGHIJKLMNOPQRSTUVWXYZ"; }
+};
+ 
+struct alpha36
+{
+    enum { ROWS = 6, COLS = 6, BASE = '0', DOMAIN = 'Z' - '0' + 1, FILLER = 'X', LATIN = 1 };
+    static int grid( char c, bool ) { return fold( c, false ); }
+    static int fold( char c, bool )
+    {
+	c = toupper( c );
+	return ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) ? c : -1;
+    }
+    static string symbols() { return "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"; }
+};
+ 
+// raw bytes: no folding, no fillers (a doubled byte takes the column rule, which is
+// invertible) and an odd trailing byte is passed through unciphered
+struct alpha256
+{
+    enum { ROWS = 16, COLS = 16, BASE = 0, DOMAIN = 256, FILLER = -1, LATIN = 0 };
+    static int grid( char c, bool ) { return ( unsigned char )c; }
+    static int fold( char c, bool ) { return ( unsigned char )c; }
+    static string symbols()
+    {
+	string s( 256, 0 );
+	for( int c = 0; c < 256; c++ ) s[c] = c;
+	return s;
+    }
+};
+ 
+// UTF-8 text for the LATIN alphabets. ASCII bytes stand for themselves and are found
+// 16 at a time; a multi-byte sequence is decoded on its own and transliterated: the
+// Latin-1 and Latin Extended-A letters (U+00C0 to U+017F) lose their accents, a few
+// becoming two letters (\xc3\x9f is ss, \xc3\x86 AE), and anything else gives none.
+// No sequence gives more letters than it has bytes, so maxReady still holds.
+struct utf8Latin
+{
+    // the length of the ASCII prefix of [p, end)
+    static size_t ascii( const char* p, const char* end )
+    {
+	const char* s = p;
+#ifdef __SSE2__
+	for( ; end - s >= 16; s += 16 )
+	{
+	    int m = _mm_movemask_epi8( _mm_loadu_si128( ( const __m128i* )s ) );
+	    if( m ) return s - p + __builtin_ctz( m );
+	}
+#endif
+	while( s != end && !( *s & 0x80 ) ) s++;
+	return s - p;
+    }
+
+    // reads the sequence at si, which starts with a non-ASCII byte, into at most two
+    // ASCII letters at sym, keeping their case; returns how many
+    static int read( const char*& si, const char* end, char* sym )
+    {
+	static const char* const table[192] = {
+	"A", "A", "A", "A", "A", "A", "AE", "C", "E", "E", "E", "E", "I", "I", "I", "I",
+	"D", "N", "O", "O", "O", "O", "O", "", "O", "U", "U", "U", "U", "Y", "TH", "ss",
+	"a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+	"d", "n", "o", "o", "o", "o", "o", "", "o", "u", "u", "u", "u", "y", "th", "y",
+	"A", "a", "A", "a", "A", "a", "C", "c", "C", "c", "C", "c", "C", "c", "D", "d",
+	"D", "d", "E", "e", "E", "e", "E", "e", "E", "e", "E", "e", "G", "g", "G", "g",
+	"G", "g", "G", "g", "H", "h", "H", "h", "I", "i", "I", "i", "I", "i", "I", "i",
+	"I", "i", "IJ", "ij", "J", "j", "K", "k", "k", "L", "l", "L", "l", "L", "l", "L",
+	"l", "L", "l", "N", "n", "N", "n", "N", "n", "n", "N", "n", "O", "o", "O", "o",
+	"O", "o", "OE", "oe", "R", "r", "R", "r", "R", "r", "S", "s", "S", "s", "S", "s",
+	"S", "s", "T", "t", "T", "t", "T", "t", "U", "u", "U", "u", "U", "u", "U", "u",
+	"U", "u", "U", "u", "W", "w", "Y", "y", "Y", "Z", "z", "Z", "z", "Z", "z", "s",
+	};
+	unsigned char b = *si++; int len = b >= 0xf0 ? 3 : b >= 0xe0 ? 2 : b >= 0xc0 ? 1 : 0;
+	unsigned cp = b & ( 0x3f >> len );
+	for( int x = 0; x < len; x++ )
+	{
+	    if( si == end || ( *si & 0xc0 ) != 0x80 ) return 0;
+	    cp = cp << 6 | ( *si++ & 0x3f );
+	}
+	if( !len || cp < 0xc0 || cp >= 0x180 ) return 0;
+	const char* r = table[cp - 0xc0]; int k = 0;
+	while( r[k] ) { sym[k] = r[k]; k++; }
+	return k;
+    }
+};
+ 
+// What getTextReady drops, kept to put back around the ciphertext. A message's
+// prepared text is cut into runs of keep letters, each preceded by drop source
+// bytes (stored in order in dropped); lower has one bit per prepared letter that was
+// lower case in the source, fillers copying the letter before them. Messages are
+// appended in turn: marks[x] is where message x starts, with one more at the end.
+struct textLayout
+{
+    struct run { uint32_t drop, keep; };
+    struct mark { size_t run, dropped, letter; };
+
+    vector<run> runs; string dropped; vector<uint64_t> lower; vector<mark> marks;
+
+    textLayout() { clear(); }
+    void clear() { runs.clear(); dropped.clear(); lower.clear(); marks.assign( 1, mark() ); }
+    size_t messages() const { return marks.size() - 1; }
+
+    // the length of message x once restored
+    size_t restoredSize( size_t x ) const
+    {
+	return marks[x + 1].dropped - marks[x].dropped + marks[x + 1].letter - marks[x].letter;
+    }
+
+    // the 16 case bits from letter k on
+    unsigned lower16( size_t k ) const
+    {
+	size_t w = k >> 6, b = k & 63; uint64_t v = w < lower.size() ? lower[w] >> b : 0;
+	if( b > 48 && w + 1 < lower.size() ) v |= lower[w + 1] << ( 64 - b );
+	return v & 0xffff;
+    }
+};
+ 
+template< class A > class basicPlayfair
+{
+public:
+    enum { ROWS = A::ROWS, COLS = A::COLS, CELLS = ROWS * COLS };
+
+    basicPlayfair() : _ij( true ) {}
+    basicPlayfair( string k, bool ij ) { setKey( k, ij ); }
+
+    void setKey( string k, bool ij )
+    {
+	createGrid( k, ij, &_m[0][0] ); indexGrid(); _ij = ij;
+    }
+
+    void doIt( string k, string t, bool ij, bool e )
+    {
+	setKey( k, ij ); display( doIt( t, e ) );
+    }
+
+    // once keyed, en/decryption keeps no state in the object and may be shared
+    string doIt( string t, bool e ) const
+    {
+	string txt = getTextReady( t, _ij, e );
+	doIt( txt.data(), &txt[0], txt.length(), e ? 1 : -1 );
+	return txt;
+    }
+
+    // four digraphs per iteration: all eight position loads are issued before any
+    // rule is applied, and the rule itself is selected with conditional moves from
+    // the packed row/column codes, so the independent chains overlap; in may alias out
+    void doIt( const char* txt, char* out, size_t len, int dir ) const
+    {
+	const unsigned char *rs = _rs[dir < 0], *cs = _cs[dir < 0]; const char* m = &_m[0][0];
+	const unsigned char* in = ( const unsigned char* )txt; size_t i = 0;
+	for( ; i + 8 <= len; i += 8 )
+	{
+	    unsigned char p[8];
+	    for( int x = 0; x < 8; x++ ) p[x] = _pos[in[i + x] - A::BASE];
+	    for( int x = 0; x < 8; x += 2 ) rule( p[x], p[x + 1], rs, cs, m, out + i + x );
+	}
+	for( ; i + 1 < len; i += 2 ) rule( _pos[in[i] - A::BASE], _pos[in[i + 1] - A::BASE], rs, cs, m, out + i );
+	if( i < len ) out[i] = in[i];
+    }
+ 
+    static string getTextReady( string t, bool ij, bool e )
+    {
+	string txt( maxReady( t.length() ), ' ' );
+	txt.resize( getTextReady( t.data(), t.length(), ij, e, &txt[0] ) );
+	return txt;
+    }
+ 
+    static size_t maxReady( size_t n ) { return n + n / 2 + 2; }
+
+    // adds the folded symbol c to the prepared text at o, p holding an unpaired one
+    static void take( int c, bool e, int& p, char*& o )
+    {
+	if( c < 0 ) return;
+	if( !e || A::FILLER < 0 ) { *o++ = c; return; }
+	if( p < 0 ) { p = c; return; }
+	*o++ = p; if( p == c ) *o++ = A::FILLER;
+	*o++ = c; p = -1;
+    }
+
+    // writes the prepared text of t[0, n) to out, which must hold maxReady( n ) bytes
+    static size_t getTextReady( const char* t, size_t n, bool ij, bool e, char* out )
+    {
+	char* o = out; int p = -1; char sym[2];
+	for( const char* si = t, *end = t + n; si != end; )
+	{
+	    const char* a = A::LATIN ? si + utf8Latin::ascii( si, end ) : end;
+	    for( ; si != a; si++ ) take( A::fold( *si, ij ), e, p, o );
+	    if( si == end ) break;
+	    for( int x = 0, m = utf8Latin::read( si, end, sym ); x < m; x++ ) take( A::fold( sym[x], ij ), e, p, o );
+	}
+	if( p >= 0 ) *o++ = p;
+	if( ( o - out ) & 1 && A::FILLER >= 0 ) *o++ = A::FILLER;
+	return o - out;
+    }
+
+    // getTextReady that also appends the layout of t to f, recording as it goes:
+    // letter k of the prepared text is the k-th assigned, fillers included
+    static size_t getTextReady( const char* t, size_t n, bool ij, bool e, char* out, textLayout& f )
+    {
+	char* o = out; int p = -1; size_t k = f.marks.back().letter, first = f.runs.size(); const char* ds = t; bool low = false;
+	f.lower.resize( ( k + maxReady( n ) ) / 64 + 1 ); char sym[2];
+	for( const char* si = t, *end = t + n; si != end; )
+	{
+	    const char* from = si; int m = 1;
+	    if( A::LATIN && *si & 0x80 ) m = utf8Latin::read( si, end, sym ); else sym[0] = *si++;
+	    for( int x = 0; x < m; x++ )
+	    {
+		int c = A::fold( sym[x], ij );
+		if( c < 0 )
+		{
+		    // a letter the grid lacks (Q without I/J merged) is left out, not kept in clear
+		    if( m == 1 && isalpha( ( unsigned char )sym[0] ) )
+		    {
+			f.dropped.append( ds, from - ds ); f.runs.push_back( textLayout::run { uint32_t( from - ds ), 0 } ); ds = si;
+		    }
+		    continue;
+		}
+		if( from > ds || f.runs.size() == first ) { f.dropped.append( ds, from - ds ); f.runs.push_back( textLayout::run { uint32_t( from - ds ), 0 } ); }
+		ds = si; uint32_t& keep = f.runs.back().keep;
+		if( !e || A::FILLER < 0 ) *o++ = c;
+		else if( p < 0 ) p = c;
+		else
+		{
+		    *o++ = p; if( p == c ) { *o++ = A::FILLER; f.lower[k >> 6] |= uint64_t( low ) << ( k & 63 ); k++; keep++; }
+		    *o++ = c; p = -1;
+		}
+		low = sym[x] != ( char )c && sym[x] >= 'a' && sym[x] <= 'z';
+		f.lower[k >> 6] |= uint64_t( low ) << ( k & 63 ); k++; keep++;
+	    }
+	}
+	if( p >= 0 ) *o++ = p;
+	if( ( o - out ) & 1 && A::FILLER >= 0 )
+	{
+	    *o++ = A::FILLER; f.lower[k >> 6] |= uint64_t( low ) << ( k & 63 ); k++; f.runs.back().keep++;
+	}
+	if( ds != t + n ) { f.dropped.append( ds, t + n - ds ); f.runs.push_back( textLayout::run { uint32_t( t + n - ds ), 0 } ); }
+	f.marks.push_back( textLayout::mark { f.runs.size(), f.dropped.size(), k } );
+	return o - out;
+    }
+
+    // puts message x of f back around its ciphertext c: dropped bytes return to their
+    // places and letters take the case of the source; out holds f.restoredSize( x ).
+    // Runs are moved 16 bytes at a time, short ones too while 16 bytes remain in the
+    // message: the excess is overwritten by the runs after it.
+    static size_t restore( const char* c, const textLayout& f, size_t x, char* out )
+    {
+	const textLayout::mark &a = f.marks[x], &b = f.marks[x + 1];
+	const char* d = f.dropped.data() + a.dropped; char* o = out; size_t k = a.letter;
+#ifdef __SSE2__
+	const char *dEnd = f.dropped.data() + b.dropped, *cEnd = c + ( b.letter - a.letter ); char* oEnd = out + f.restoredSize( x );
+#endif
+	for( size_t r = a.run; r < b.run; r++ )
+	{
+	    size_t n = f.runs[r].drop, i = 0;
+#ifdef __SSE2__
+	    if( n <= 16 && d + 16 <= dEnd && o + 16 <= oEnd ) _mm_storeu_si128( ( __m128i* )o, _mm_loadu_si128( ( const __m128i* )d ) );
+	    else
+#endif
+	    memcpy( o, d, n );
+	    o += n; d += n; n = f.runs[r].keep;
+#ifdef __SSE2__
+	    const __m128i bit = _mm_set_epi8( -128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1 ), lc = _mm_set1_epi8( 0x20 );
+	    for( ; i < n && c + i + 16 <= cEnd && o + i + 16 <= oEnd; i += 16 )
+	    {
+		unsigned m = f.lower16( k + i );
+		__m128i s = _mm_and_si128( _mm_unpacklo_epi64( _mm_set1_epi8( m & 0xff ), _mm_set1_epi8( m >> 8 ) ), bit );
+		__m128i v = _mm_loadu_si128( ( const __m128i* )( c + i ) );
+		_mm_storeu_si128( ( __m128i* )( o + i ), _mm_or_si128( v, _mm_and_si128( _mm_cmpeq_epi8( s, bit ), lc ) ) );
+	    }
+	    i = min( i, n );
+#endif
+	    for( ; i < n; i++ ) o[i] = c[i] | ( f.lower[( k + i ) >> 6] >> ( ( k + i ) & 63 ) & 1 ) << 5;
+	    o += n; c += n; k += n;
+	}
+	return o - out;
+    }
+ 
+    // decrypted text p[0, n) without its fillers, returning the new length. The text
+    // is read from the start in the steps getTextReady wrote it: a letter pair, or a
+    // doubled letter split by a filler (aXa), whose X goes. With pad a final X goes
+    // too if the text is even, unless it closes an aXa. Every X stripped is a guess:
+    // AAB and AXAB both prepare as AXAB, and a message may end in a real X, so the
+    // count of them is added to *stripped for callers to report. Candidates (any X
+    // between equal letters) are found 16 bytes per compare and the text between
+    // fillers is moved in one piece; out may alias p.
+    static size_t unfill( const char* p, size_t n, char* out, bool pad, size_t* stripped = 0 )
+    {
+	if( A::FILLER < 0 ) { memmove( out, p, n ); return n; }
+	// steps start at the even distances from base
+	char* o = out; size_t i = 1, from = 0, base = 0;
+#ifdef __SSE2__
+	const __m128i x = _mm_set1_epi8( A::FILLER );
+	for( ; i + 17 <= n; i += 16 )
+	{
+	    __m128i v = _mm_loadu_si128( ( const __m128i* )( p + i ) );
+	    __m128i prev = _mm_loadu_si128( ( const __m128i* )( p + i - 1 ) ), next = _mm_loadu_si128( ( const __m128i* )( p + i + 1 ) );
+	    for( unsigned m = _mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi8( v, x ), _mm_cmpeq_epi8( prev, next ) ) ); m; m &= m - 1 )
+	    {
+		size_t j = i + __builtin_ctz( m );
+		if( j <= base || ( j - 1 - base ) & 1 ) continue;
+		memmove( o, p + from, j - from ); o += j - from; from = j + 1; base = j + 2;
+	    }
+	}
+#endif
+	for( ; i + 1 < n; i++ )
+	    if( p[i] == A::FILLER && p[i - 1] == p[i + 1] && i > base && !( ( i - 1 - base ) & 1 ) )
+	    {
+		memmove( o, p + from, i - from ); o += i - from; from = i + 1; base = i + 2;
+	    }
+	size_t end = pad && n && !( n & 1 ) && p[n - 1] == A::FILLER && n > base ? n - 1 : n;
+	memmove( o, p + from, end - from ); o += end - from;
+	if( stripped ) *stripped += n - ( o - out );
+	return o - out;
+    }
+
+    static void createGrid( string k, bool ij, char* m )
+    {
+	if( k.length() < 1 ) k = "KEYWORD"; 
+	k += A::symbols(); string nk = "";
+	for( string::iterator si = k.begin(); si != k.end(); si++ )
+	{
+	    int c = A::grid( *si, ij ); if( c < 0 ) continue;
+	    if( nk.find( c ) == string::npos ) nk += c;
+	}
+	copy( nk.begin(), nk.end(), m );
+    }
+ 
+private:
+    static void rule( unsigned a, unsigned b, const unsigned char* rs, const unsigned char* cs, const char* m, char* out )
+    {
+	unsigned ra = a >> 4, ca = a & 15, rb = b >> 4, cb = b & 15;
+	bool sc = ca == cb, sr = !sc && ra == rb;
+	unsigned r1 = sc ? rs[ra] : ra, r2 = sc ? rs[rb] : rb;
+	unsigned c1 = sr ? cs[ca] : sc ? ca : cb, c2 = sr ? cs[cb] : sc ? cb : ca;
+	out[0] = m[r1 * COLS + c1]; out[1] = m[r2 * COLS + c2];
+    }
+ 
+    void indexGrid()
+    {
+	memset( _pos, 0, sizeof( _pos ) );
+	for( int y = 0; y < ROWS; y++ )
+	    for( int x = 0; x < COLS; x++ ) _pos[( unsigned char )_m[y][x] - A::BASE] = y << 4 | x;
+	for( int y = 0; y < ROWS; y++ ) _rs[0][y] = ( y + 1 ) % ROWS, _rs[1][y] = ( y + ROWS - 1 ) % ROWS;
+	for( int x = 0; x < COLS; x++ ) _cs[0][x] = ( x + 1 ) % COLS, _cs[1][x] = ( x + COLS - 1 ) % COLS;
+    }
+ 
+    static void display( const string& txt )
+    {
+	cout << "\n\n OUTPUT:\n=========" << endl;
+	string::const_iterator si = txt.begin(); int cnt = 0;
+	while( si != txt.end() )
+	{
+	    cout << *si; si++; cout << *si << " "; si++;
+	    if( ++cnt >= 26 ) cout << endl, cnt = 0;
+	}
+	cout << endl << endl;
+    }
+ 
+    bool _ij; char _m[ROWS][COLS];
+    unsigned char _pos[A::DOMAIN], _rs[2][ROWS], _cs[2][COLS];
+};
+ 
+typedef basicPlayfair<alpha25> playfair;
+ 
+// Blocks of HUGE_MIN bytes or more (the byte-grid key, large key sweeps) are mapped
+// in whole 2 MiB pages to cut TLB misses: explicit huge pages if any are reserved,
+// else an aligned mapping advised for transparent ones. Smaller blocks, and systems
+// without mmap, use the heap.
+enum { HUGE_PAGE = 2 << 20, HUGE_MIN = 256 << 10 };
+ 
+inline void* hugeAlloc( size_t n )
+{
+#ifdef MAP_ANONYMOUS
+    if( n >= HUGE_MIN )
+    {
+	size_t len = ( n + HUGE_PAGE - 1 ) & ~size_t( HUGE_PAGE - 1 );
+#ifdef MAP_HUGETLB
+	void* p = mmap( 0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+	if( p != MAP_FAILED ) return p;
+#endif
+	char* q = ( char* )mmap( 0, len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if( q == MAP_FAILED ) throw bad_alloc();
+	char* a = ( char* )( ( uintptr_t( q ) + HUGE_PAGE - 1 ) & ~uintptr_t( HUGE_PAGE - 1 ) );
+	if( a > q ) munmap( q, a - q );
+	munmap( a + len, q + HUGE_PAGE - a );
+#ifdef MADV_HUGEPAGE
+	madvise( a, len, MADV_HUGEPAGE );
+#endif
+	return a;
+    }
+#endif
+    return ::operator new( n );
+}
+ 
+inline void hugeFree( void* p, size_t n )
+{
+#ifdef MAP_ANONYMOUS
+    if( n >= HUGE_MIN ) { munmap( p, ( n + HUGE_PAGE - 1 ) & ~size_t( HUGE_PAGE - 1 ) ); return; }
+#endif
+    ::operator delete( p );
+}
+ 
+template< class T > struct hugeAllocator
+{
+    typedef T value_type;
+    hugeAllocator() {}
+    template< class U > hugeAllocator( const hugeAllocator<U>& ) {}
+    T* allocate( size_t n ) { return ( T* )hugeAlloc( n * sizeof( T ) ); }
+    void deallocate( T* p, size_t n ) { hugeFree( p, n * sizeof( T ) ); }
+    bool operator==( const hugeAllocator& ) const { return true; }
+    bool operator!=( const hugeAllocator& ) const { return false; }
+};
+ 
+template< class A > class basicSweep
+{
+public:
+    enum { ROWS = A::ROWS, COLS = A::COLS, CELLS = ROWS * COLS };
+
+    basicSweep( bool ij ) : _ij( ij ), _dirty( false ), _n( 0 ), _cap( 0 ) {}
+
+    void addKey( string k )
+    {
+	char m[CELLS]; basicPlayfair<A>::createGrid( k, _ij, m );
+	_grids.append( m, CELLS ); _n++; _dirty = true;
+    }
+
+    size_t size() const { return _n; }
+
+    vector<string> doIt( string t, bool e )
+    {
+	if( _dirty ) compile();
+	string txt = basicPlayfair<A>::getTextReady( t, _ij, e );
+	size_t len = txt.length(); int dir = e ? 1 : -1;
+	vector<char> out( len * _cap );
+	for( size_t i = 0; i + 1 < len; i += 2 )
+	{
+	    if( i + 3 < len ) prefetch( ( unsigned char )txt[i + 2] - A::BASE, ( unsigned char )txt[i + 3] - A::BASE );
+	    sweep( ( unsigned char )txt[i] - A::BASE, ( unsigned char )txt[i + 1] - A::BASE, dir, &out[i * _cap], &out[( i + 1 ) * _cap] );
+	}
+	if( len & 1 ) fill_n( &out[( len - 1 ) * _cap], _cap, txt[len - 1] );
+	vector<string> res( _n, string( len, ' ' ) );
+	for( size_t i = 0; i < len; i++ )
+	    for( size_t k = 0; k < _n; k++ ) res[k][i] = out[i * _cap + k];
+	return res;
+    }
+
+private:
+    enum { LANES = 32 };
+
+    static size_t lanes( size_t n ) { return ( n + LANES - 1 ) / LANES * LANES; }
+    static int wrap( int x, int n ) { return x + n * ( ( x < 0 ) - ( x >= n ) ); }
+
+    void compile()
+    {
+	_cap = lanes( _n ); _dirty = false;
+	_row.assign( A::DOMAIN * _cap, 0 ); _col.assign( A::DOMAIN * _cap, 0 ); _m.assign( CELLS * _cap + 3, 0 );
+	for( size_t k = 0; k < _cap; k++ )
+	{
+	    const char* m = &_grids[( k < _n ? k : 0 ) * CELLS];
+	    for( int p = 0; p < CELLS; p++ )
+	    {
+		size_t l = ( unsigned char )m[p] - A::BASE;
+		_row[l * _cap + k] = p / COLS; _col[l * _cap + k] = p % COLS; _m[p * _cap + k] = m[p];
+	    }
+	}
+    }
+
+    // the next digraph's table rows start at unrelated addresses; the hardware
+    // prefetcher follows each one only after its first misses
+    void prefetch( int p, int q ) const
+    {
+	__builtin_prefetch( &_row[p * _cap] ); __builtin_prefetch( &_col[p * _cap] );
+	__builtin_prefetch( &_row[q * _cap] ); __builtin_prefetch( &_col[q * _cap] );
+    }
+
+    // one digraph under every key: lane k reads key k's row/col tables, so the
+    // position loads are contiguous and only the final grid lookup is a gather
+    void sweep( int p, int q, int dir, char* o1, char* o2 ) const
+    {
+	const unsigned char *ra = &_row[p * _cap], *ca = &_col[p * _cap], *rb = &_row[q * _cap], *cb = &_col[q * _cap];
+	const char* m = _m.data(); size_t k = 0, cap = _cap;
+#ifdef __AVX2__
+	// eight keys per step: the grid bytes are fetched by a 32-bit gather at byte
+	// scale and masked, which needs _m padded by three bytes
+	const __m256i d = _mm256_set1_epi32( dir ), rows = _mm256_set1_epi32( ROWS ), cols = _mm256_set1_epi32( COLS ),
+	              step = _mm256_set1_epi32( cap ), lo = _mm256_set1_epi32( 0xff ), zero = _mm256_setzero_si256();
+	__m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+	for( ; k < cap; k += 8, lane = _mm256_add_epi32( lane, _mm256_set1_epi32( 8 ) ) )
+	{
+	    __m256i r1 = load8( ra + k ), c1 = load8( ca + k ), r2 = load8( rb + k ), c2 = load8( cb + k );
+	    __m256i sc = _mm256_cmpeq_epi32( c1, c2 ), sr = _mm256_andnot_si256( sc, _mm256_cmpeq_epi32( r1, r2 ) );
+	    r1 = wrap8( _mm256_add_epi32( r1, _mm256_and_si256( sc, d ) ), rows, zero );
+	    r2 = wrap8( _mm256_add_epi32( r2, _mm256_and_si256( sc, d ) ), rows, zero );
+	    __m256i s1 = _mm256_blendv_epi8( c2, c1, sc ), s2 = _mm256_blendv_epi8( c1, c2, sc );
+	    s1 = _mm256_blendv_epi8( s1, wrap8( _mm256_add_epi32( c1, d ), cols, zero ), sr );
+	    s2 = _mm256_blendv_epi8( s2, wrap8( _mm256_add_epi32( c2, d ), cols, zero ), sr );
+	    __m256i x1 = _mm256_add_epi32( _mm256_mullo_epi32( _mm256_add_epi32( _mm256_mullo_epi32( r1, cols ), s1 ), step ), lane );
+	    __m256i x2 = _mm256_add_epi32( _mm256_mullo_epi32( _mm256_add_epi32( _mm256_mullo_epi32( r2, cols ), s2 ), step ), lane );
+	    store8( o1 + k, _mm256_and_si256( _mm256_i32gather_epi32( ( const int* )m, x1, 1 ), lo ) );
+	    store8( o2 + k, _mm256_and_si256( _mm256_i32gather_epi32( ( const int* )m, x2, 1 ), lo ) );
+	}
+#endif
+	for( ; k < cap; k++ )
+	{
+	    int sc = ca[k] == cb[k], sr = !sc && ra[k] == rb[k];
+	    int r1 = wrap( ra[k] + sc * dir, ROWS ), r2 = wrap( rb[k] + sc * dir, ROWS );
+	    int c1 = sr ? wrap( ca[k] + dir, COLS ) : sc ? ca[k] : cb[k];
+	    int c2 = sr ? wrap( cb[k] + dir, COLS ) : sc ? cb[k] : ca[k];
+	    o1[k] = m[( r1 * COLS + c1 ) * cap + k]; o2[k] = m[( r2 * COLS + c2 ) * cap + k];
+	}
+    }
+
+#ifdef __AVX2__
+    static __m256i load8( const unsigned char* p ) { return _mm256_cvtepu8_epi32( _mm_loadl_epi64( ( const __m128i* )p ) ); }
+    static __m256i wrap8( __m256i x, __m256i n, __m256i zero )
+    {
+	__m256i over = _mm256_andnot_si256( _mm256_cmpgt_epi32( n, x ), n ), under = _mm256_and_si256( _mm256_cmpgt_epi32( zero, x ), n );
+	return _mm256_sub_epi32( _mm256_add_epi32( x, under ), over );
+    }
+    static void store8( char* p, __m256i v )
+    {
+	v = _mm256_packus_epi32( v, v ); v = _mm256_packus_epi16( v, v );
+	uint32_t a = _mm_cvtsi128_si32( _mm256_castsi256_si128( v ) ), b = _mm_cvtsi128_si32( _mm256_extracti128_si256( v, 1 ) );
+	memcpy( p, &a, 4 ); memcpy( p + 4, &b, 4 );
+    }
+#endif
+
+    bool _ij, _dirty; size_t _n, _cap; string _grids;
+    vector< unsigned char, hugeAllocator<unsigned char> > _row, _col; vector< char, hugeAllocator<char> > _m;
+};
+ 
+typedef basicSweep<alpha25> keySweep;
+ 
+// 64-bit multiply/xor-shift hash over 8-byte words
+inline uint64_t hashBytes( const char* p, size_t n, uint64_t h )
+{
+    const uint64_t m = 0x9e3779b97f4a7c15ull; uint64_t w;
+    for( h ^= n * m; n >= 8; p += 8, n -= 8 ) { memcpy( &w, p, 8 ); h = ( h ^ w ) * m; h ^= h >> 29; }
+    w = 0; memcpy( &w, p, n ); h = ( h ^ w ) * m;
+    return h ^ h >> 32;
+}
+ 
+template< class A > class basicKey
+{
+public:
+    enum { ROWS = A::ROWS, COLS = A::COLS, CELLS = ROWS * COLS, PAIRS = A::DOMAIN * A::DOMAIN };
+
+    // the byte grid's tables are over HUGE_MIN and so land on huge pages
+    static void* operator new( size_t n ) { return hugeAlloc( n ); }
+    static void operator delete( void* p, size_t n ) { hugeFree( p, n ); }
+
+    basicKey( string k, bool ij ) : _ij( ij ), _fill( true )
+    {
+	init(); basicPlayfair<A>::createGrid( k, ij, _m );
+	for( int p = 0; p < CELLS; p++ )
+	    for( int q = 0; q < CELLS; q++ )
+	    {
+		unsigned short v = rule( p / COLS, p % COLS, q / COLS, q % COLS, 1 );
+		set( _m[p], _m[q], v & 0xff, v >> 8 );
+	    }
+	seal();
+    }
+
+    bool ij() const { return _ij; }
+
+    // identifies the mapping: keys that cipher alike share an id
+    uint64_t id() const { return _id; }
+
+    // Arrow-style packed layout: message x is data[off[x], off[x + 1]); the prepared
+    // texts are packed into out the same way and ciphered in a single pass
+    void doIt( const char* data, const size_t* off, size_t n, bool e, vector<char>& out, vector<size_t>& outOff ) const
+    {
+	prepare( data, off, n, e, out, outOff ); crypt( out.data(), out.data(), out.size(), e );
+    }
+
+    // one message: prepares t[0, n) into out, which must hold maxReady( n ) bytes,
+    // and ciphers it there; returns the output length
+    size_t doIt( const char* t, size_t n, bool e, char* out ) const
+    {
+	size_t len = prepare( t, n, e, out );
+	crypt( out, out, len, e ); return len;
+    }
+
+    // the preparation half of the doIt overloads, for callers timing the stages apart
+    size_t prepare( const char* t, size_t n, bool e, char* out ) const
+    {
+	return basicPlayfair<A>::getTextReady( t, n, _ij, e && _fill, out );
+    }
+
+    void prepare( const char* data, const size_t* off, size_t n, bool e, vector<char>& out, vector<size_t>& outOff ) const
+    {
+	out.resize( basicPlayfair<A>::maxReady( off[n] - off[0] ) + 2 * n ); outOff.assign( 1, 0 );
+	size_t o = 0;
+	for( size_t x = 0; x < n; x++ )
+	    outOff.push_back( o += prepare( data + off[x], off[x + 1] - off[x], e, out.data() + o ) );
+	out.resize( o );
+    }
+
+    // strips the fillers from decrypted text in place; keys that split no doubled
+    // letters (two- and four-square) still pad an odd text, so with pad its final X goes
+    size_t unfill( char* p, size_t n, bool pad, size_t* stripped = 0 ) const
+    {
+	if( _fill ) return basicPlayfair<A>::unfill( p, n, p, pad, stripped );
+	if( !pad || !n || n & 1 || A::FILLER < 0 || p[n - 1] != A::FILLER ) return n;
+	if( stripped ) ++*stripped;
+	return n - 1;
+    }
+
+    // format-preserving forms: the layout of every message is appended to f, for
+    // basicPlayfair<A>::restore once ciphered
+    size_t prepare( const char* t, size_t n, bool e, char* out, textLayout& f ) const
+    {
+	return basicPlayfair<A>::getTextReady( t, n, _ij, e && _fill, out, f );
+    }
+
+    void prepare( const char* data, const size_t* off, size_t n, bool e, vector<char>& out, vector<size_t>& outOff, textLayout& f ) const
+    {
+	out.resize( basicPlayfair<A>::maxReady( off[n] - off[0] ) + 2 * n ); outOff.assign( 1, 0 );
+	size_t o = 0;
+	for( size_t x = 0; x < n; x++ )
+	    outOff.push_back( o += prepare( data + off[x], off[x + 1] - off[x], e, out.data() + o, f ) );
+	out.resize( o );
+    }
+
+    // in holds prepared text; may alias out
+    void crypt( const char* in, char* out, size_t len, bool e ) const
+    {
+	size_t i = 0;
+#ifdef __AVX2__
+	const unsigned short* dg = _dg[!e];
+	const __m256i base = _mm256_set1_epi32( A::BASE * ( A::DOMAIN + 1 ) ), dom = _mm256_set1_epi32( A::DOMAIN ),
+	              lo = _mm256_set1_epi32( 0xff ), lo16 = _mm256_set1_epi32( 0xffff );
+	for( ; i + 16 <= len; i += 16 )
+	{
+	    __m256i v = _mm256_cvtepu16_epi32( _mm_loadu_si128( ( const __m128i* )( in + i ) ) );
+	    __m256i x = _mm256_sub_epi32( _mm256_add_epi32( _mm256_mullo_epi32( _mm256_and_si256( v, lo ), dom ), _mm256_srli_epi32( v, 8 ) ), base );
+	    __m256i r = _mm256_and_si256( _mm256_i32gather_epi32( ( const int* )dg, x, 2 ), lo16 );
+	    r = _mm256_permute4x64_epi64( _mm256_packus_epi32( r, r ), 0xd8 );
+	    _mm_storeu_si128( ( __m128i* )( out + i ), _mm256_castsi256_si128( r ) );
+	}
+#endif
+	for( ; i + 1 < len; i += 2 )
+	{
+	    unsigned short v = pair( in + i, e );
+	    out[i] = v & 0xff; out[i + 1] = v >> 8;
+	}
+	if( i < len ) out[i] = in[i];
+    }
+
+    unsigned short pair( const char* p, bool e ) const
+    {
+	return _dg[!e][( ( unsigned char )p[0] - A::BASE ) * A::DOMAIN + ( unsigned char )p[1] - A::BASE];
+    }
+
+protected:
+    // for sibling ciphers: tables start as the identity and are filled with set();
+    // the tag keeps basicKey( "key", ij ) from converting its literal to bool
+    struct identity {};
+    basicKey( identity, bool ij, bool fill ) : _ij( ij ), _fill( fill ) { init(); }
+
+    void set( int a, int b, int x, int y )
+    {
+	a = ( unsigned char )a - A::BASE; b = ( unsigned char )b - A::BASE;
+	x = ( unsigned char )x - A::BASE; y = ( unsigned char )y - A::BASE;
+	_dg[0][a * A::DOMAIN + b] = ( A::BASE + x ) | ( A::BASE + y ) << 8;
+	_dg[1][x * A::DOMAIN + y] = ( A::BASE + a ) | ( A::BASE + b ) << 8;
+    }
+
+    // called once the tables are filled
+    void seal() { _id = hashBytes( ( const char* )_dg[0], sizeof( _dg[0] ), _ij | _fill << 1 ); }
+
+    char _m[CELLS];
+
+private:
+    void init()
+    {
+	for( int a = 0; a < A::DOMAIN; a++ )
+	    for( int b = 0; b < A::DOMAIN; b++ )
+		_dg[0][a * A::DOMAIN + b] = _dg[1][a * A::DOMAIN + b] = ( A::BASE + a ) | ( A::BASE + b ) << 8;
+	_dg[0][PAIRS] = _dg[1][PAIRS] = 0;
+    }
+
+    static int wrap( int x, int n ) { return x + n * ( ( x < 0 ) - ( x >= n ) ); }
+
+    unsigned short rule( int ra, int ca, int rb, int cb, int dir ) const
+    {
+	int r1 = ra, c1 = cb, r2 = rb, c2 = ca;
+	if( ca == cb )      { r1 = wrap( ra + dir, ROWS ); c1 = ca; r2 = wrap( rb + dir, ROWS ); c2 = cb; }
+	else if( ra == rb ) { c1 = wrap( ca + dir, COLS ); c2 = wrap( cb + dir, COLS ); }
+	return ( unsigned char )_m[r1 * COLS + c1] | ( unsigned char )_m[r2 * COLS + c2] << 8;
+    }
+
+    bool _ij, _fill; uint64_t _id;
+    unsigned short _dg[2][PAIRS + 1];
+};
+ 
+typedef basicKey<alpha25> compiledKey;
+ 
+// two-square (vertical): the first letter is found in the top grid, the second in
+// the bottom one; a pair in the same column passes through, any other pair takes
+// the opposite corners of its rectangle
+template< class A > class basicTwoSquare : public basicKey<A>
+{
+public:
+    enum { COLS = A::COLS, CELLS = A::ROWS * A::COLS };
+
+    basicTwoSquare( string k1, string k2, bool ij ) : basicKey<A>( typename basicKey<A>::identity(), ij, false )
+    {
+	char t[CELLS], b[CELLS];
+	basicPlayfair<A>::createGrid( k1, ij, t ); basicPlayfair<A>::createGrid( k2, ij, b );
+	copy( t, t + CELLS, this->_m );
+	for( int p = 0; p < CELLS; p++ )
+	    for( int q = 0; q < CELLS; q++ )
+	    {
+		int r1 = p / COLS, c1 = p % COLS, r2 = q / COLS, c2 = q % COLS;
+		if( c1 == c2 ) this->set( t[p], b[q], t[p], b[q] );
+		else this->set( t[p], b[q], t[r1 * COLS + c2], b[r2 * COLS + c1] );
+	    }
+	this->seal();
+    }
+};
+ 
+// four-square: plaintext pairs are looked up in two plain grids (top left, bottom
+// right) and replaced from the keyed grids (top right, bottom left)
+template< class A > class basicFourSquare : public basicKey<A>
+{
+public:
+    enum { COLS = A::COLS, CELLS = A::ROWS * A::COLS };
+
+    basicFourSquare( string k1, string k2, bool ij ) : basicKey<A>( typename basicKey<A>::identity(), ij, false )
+    {
+	char pl[CELLS], tr[CELLS], bl[CELLS];
+	basicPlayfair<A>::createGrid( A::symbols(), ij, pl );
+	basicPlayfair<A>::createGrid( k1, ij, tr ); basicPlayfair<A>::createGrid( k2, ij, bl );
+	copy( tr, tr + CELLS, this->_m );
+	for( int p = 0; p < CELLS; p++ )
+	    for( int q = 0; q < CELLS; q++ )
+		this->set( pl[p], pl[q], tr[p / COLS * COLS + q % COLS], bl[q / COLS * COLS + p % COLS] );
+	this->seal();
+    }
+};
+ 
+typedef basicTwoSquare<alpha25> twoSquare;
+typedef basicFourSquare<alpha25> fourSquare;
+ 
+// finds the next of a, b or c in p[i, n), sixteen bytes per compare on SSE2
+inline size_t scan( const char* p, size_t n, size_t i, char a, char b, char c )
+{
+#ifdef __SSE2__
+    const __m128i va = _mm_set1_epi8( a ), vb = _mm_set1_epi8( b ), vc = _mm_set1_epi8( c );
+    for( ; i + 16 <= n; i += 16 )
+    {
+	__m128i v = _mm_loadu_si128( ( const __m128i* )( p + i ) );
+	int m = _mm_movemask_epi8( _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, va ), _mm_cmpeq_epi8( v, vb ) ), _mm_cmpeq_epi8( v, vc ) ) );
+	if( m ) return i + __builtin_ctz( m );
+    }
+#endif
+    for( ; i < n; i++ ) if( p[i] == a || p[i] == b || p[i] == c ) return i;
+    return n;
+}
+ 
+// letters of p[0, n) as codes 0..25 at out, which holds n + 16 bytes, either case;
+// returns how many. other counts the bytes that are neither letters nor whitespace.
+// Blocks of 16 letters, the usual ciphertext, are converted in one step.
+inline size_t letterCodes( const char* p, size_t n, unsigned char* out, size_t& other )
+{
+    unsigned char* o = out; size_t i = 0; other = 0;
+#ifdef __SSE2__
+    const __m128i up = _mm_set1_epi8( ~0x20 ), a = _mm_set1_epi8( 'A' - 1 ), z = _mm_set1_epi8( 'Z' + 1 ), base = _mm_set1_epi8( 'A' );
+#endif
+    while( i < n )
+    {
+	size_t end = min( i + 16, n );
+#ifdef __SSE2__
+	if( end - i == 16 )
+	{
+	    __m128i u = _mm_and_si128( _mm_loadu_si128( ( const __m128i* )( p + i ) ), up );
+	    if( _mm_movemask_epi8( _mm_and_si128( _mm_cmpgt_epi8( u, a ), _mm_cmplt_epi8( u, z ) ) ) == 0xffff )
+	    {
+		_mm_storeu_si128( ( __m128i* )o, _mm_sub_epi8( u, base ) ); o += 16; i = end; continue;
+	    }
+	}
+#endif
+	for( ; i < end; i++ )
+	{
+	    unsigned char c = p[i] & ~0x20;
+	    if( c >= 'A' && c <= 'Z' ) *o++ = c - 'A';
+	    else if( !isspace( ( unsigned char )p[i] ) ) other++;
+	}
+    }
+    return o - out;
+}
+ 
+// the cell of the digraph whose letter codes are the low two bytes of w in a table
+// of 32 x 32 counters
+inline unsigned digraphCell( uint64_t w ) { return ( w & 31 ) << 5 | ( w >> 8 & 31 ); }
+ 
+// How likely a blob is 5x5 Playfair ciphertext, from 0 to 1. Playfair leaves an even
+// number of letters, never both J and Q (the grid merges one and drops the other),
+// few digraphs of two equal letters (only where the pairing shifts after a split
+// doubled letter) and the digraph statistics of its plaintext, so digraphs repeat
+// far more often than in random letters while single letters come out flatter than
+// in the plaintext. The blob is weighed against both alternatives, plaintext or a
+// monoalphabetic substitution of it (letter coincidence near 0.066, 3% doubled
+// digraphs) and random or polyalphabetic letters (coincidence near 0.040, digraphs
+// repeating by chance), and the log-odds against the likelier of the two decide.
+// Any byte but letters and whitespace weighs against it. Scratch tables are kept
+// between calls, so use one detector per thread.
+class playfairDetector
+{
+public:
+    enum { BANKS = 2 };
+
+    playfairDetector() : _dg( BANKS << 10 ) {}
+
+    double score( const char* p, size_t n )
+    {
+	if( _codes.size() < n + 16 ) _codes.resize( n + 16 );
+	size_t other, len = letterCodes( p, n, _codes.data(), other );
+	const unsigned char* c = _codes.data(); double pairs = len / 2;
+	if( len < 2 || len & 1 ) return 0;
+
+	// digraphs, eight codes per load, alternately into BANKS copies of the table so
+	// that a repeated digraph is not a chain of stores through one counter; all the
+	// statistics come from these counts
+	uint32_t *dg = _dg.data(), *dg1 = dg + 1024; size_t i = 0;
+	for( ; i + 8 <= len; i += 8 )
+	{
+	    uint64_t w; memcpy( &w, c + i, 8 );
+	    dg[digraphCell( w )]++; dg1[digraphCell( w >> 16 )]++; dg[digraphCell( w >> 32 )]++; dg1[digraphCell( w >> 48 )]++;
+	}
+	for( ; i < len; i += 2 ) dg[c[i] << 5 | c[i + 1]]++;
+
+	// the banks are summed and cleared, over the digraphs seen for short blobs (each
+	// cell adding nothing once cleared) and row by row over the table for long ones.
+	// Letters are counted from their digraphs, first letters in f and second in g
+	uint64_t f[32] = {}, g[32] = {}, sq = 0, diag = 0; double ic = 0;
+	if( pairs < 256 )
+	    for( i = 0; i < len; i += 2 )
+	    {
+		unsigned d = c[i] << 5 | c[i + 1]; uint64_t k = dg[d] + dg1[d]; dg[d] = dg1[d] = 0;
+		f[c[i]] += k; g[c[i + 1]] += k; sq += k * k; diag += c[i] == c[i + 1] ? k : 0;
+	    }
+	else
+	{
+	    uint32_t col[32] = {};
+	    for( unsigned r = 0; r < 26; r++ )
+	    {
+		uint32_t row = 0;
+		for( unsigned x = 0; x < 32; x++ )
+		{
+		    uint32_t k = dg[r << 5 | x] + dg1[r << 5 | x]; row += k; col[x] += k; sq += uint64_t( k ) * k;
+		}
+		f[r] += row; diag += dg[r << 5 | r] + dg1[r << 5 | r];
+	    }
+	    for( unsigned x = 0; x < 32; x++ ) g[x] = col[x];
+	    memset( dg, 0, ( BANKS << 10 ) * sizeof( uint32_t ) );
+	}
+	for( int x = 0; x < 32; x++ ) f[x] += g[x];
+	if( f['J' - 'A'] && f['Q' - 'A'] ) return 0;
+	for( int x = 0; x < 26; x++ ) ic += double( f[x] ) * ( f[x] - 1.0 );
+	ic /= double( len ) * ( len - 1 );
+	double repeats = ( sq - pairs ) / 2, doubled = diag;
+
+	// log likelihood ratios, Playfair over each alternative
+	double sd = 0.1 / sqrt( double( len ) ) + 0.002, chance = pairs * ( pairs - 1 ) / 2 / 625;
+	double plain = coincidence( ic, 0.050, 0.066, sd ) + poisson( doubled, 0.015 * pairs, 0.03 * pairs );
+	double random = coincidence( ic, 0.050, 0.040, sd ) + poisson( doubled, 0.015 * pairs, ic * pairs )
+	    + clamp( poisson( repeats, 4 * chance, chance ) ) + min( len / 26.0 - log( 2.0 ), 20.0 );
+	double odds = min( plain, random ) - 4.6 * other;
+	return 1 / ( 1 + exp( -odds ) );
+    }
+
+private:
+    static double clamp( double x ) { return min( max( x, -20.0 ), 20.0 ); }
+
+    // letter coincidence ic under normal errors around m1 against m0
+    static double coincidence( double ic, double m1, double m0, double sd )
+    {
+	return clamp( ( ( ic - m0 ) * ( ic - m0 ) - ( ic - m1 ) * ( ic - m1 ) ) / ( 2 * sd * sd ) );
+    }
+
+    // k events at Poisson rate l1 against rate l0
+    static double poisson( double k, double l1, double l0 )
+    {
+	l1 = max( l1, 0.1 ); l0 = max( l0, 0.1 );
+	return clamp( k * log( l1 / l0 ) - l1 + l0 );
+    }
+
+    vector<unsigned char> _codes; vector<uint32_t> _dg;
+};
+ 
+// Letter and digraph counts of a letter stream in both alignments: digraph[0] holds
+// the pairs at letters (0, 1), (2, 3).., digraph[1] those at (1, 2), (3, 4)... Plain
+// data, written as is by --histogram for the solver to map: little-endian on every
+// target this builds for, 11040 bytes.
+struct freqTable
+{
+    char magic[8]; uint64_t letters, single[26], digraph[2][26][26];
+
+    freqTable() { memset( this, 0, sizeof( *this ) ); memcpy( magic, "PFHIST1", 8 ); }
+
+    void merge( const freqTable& t )
+    {
+	letters += t.letters;
+	for( int x = 0; x < 26; x++ ) single[x] += t.single[x];
+	for( int a = 0; a < 2; a++ )
+	    for( int x = 0; x < 26; x++ )
+		for( int y = 0; y < 26; y++ ) digraph[a][x][y] += t.digraph[a][x][y];
+    }
+};
+ 
+// Counts letter codes (0..25, as letterCodes makes them) into a freqTable. Each
+// alignment keeps BANKS copies of its table and consecutive digraphs alternate
+// between them, so a repeated digraph is not a chain of stores through one counter;
+// codes are read eight per load and letters are not counted apart, as every letter
+// is in one alignment-0 digraph but an odd last one. Counts are 32-bit until
+// flush(), which must come before 2^32 letters.
+class digraphCounter
+{
+public:
+    enum { BANKS = 2 };
+
+    digraphCounter() : _dg( 2 * BANKS << 10 ), _odd(), _n( 0 ) {}
+
+    // c[0, n) from an even position of the stream, n even unless it ends there; with
+    // more, c[n] is the letter after it and the alignment-1 digraph across is counted
+    void add( const unsigned char* c, size_t n, bool more )
+    {
+	uint32_t *a = _dg.data(), *a1 = a + 1024, *b = a + ( BANKS << 10 ), *b1 = b + 1024; size_t i = 0;
+	for( ; i + 8 < n || ( i + 8 == n && more ); i += 8 )
+	{
+	    uint64_t w; memcpy( &w, c + i, 8 );
+	    a[digraphCell( w )]++; a1[digraphCell( w >> 16 )]++; a[digraphCell( w >> 32 )]++; a1[digraphCell( w >> 48 )]++;
+	    b[digraphCell( w >> 8 )]++; b1[digraphCell( w >> 24 )]++; b[digraphCell( w >> 40 )]++; b1[digraphCell( w >> 56 | uint64_t( c[i + 8] ) << 8 )]++;
+	}
+	for( ; i + 1 < n; i += 2 )
+	{
+	    a[c[i] << 5 | c[i + 1]]++;
+	    if( i + 2 < n || more ) b[c[i + 1] << 5 | c[i + 2]]++;
+	}
+	if( i < n ) _odd[c[i]]++;
+	_n += n;
+    }
+
+    // adds the counts so far to t and starts again
+    void flush( freqTable& t )
+    {
+	const uint32_t* d = _dg.data();
+	for( int al = 0; al < 2; al++, d += BANKS << 10 )
+	    for( int x = 0; x < 26; x++ )
+		for( int y = 0; y < 26; y++ )
+		{
+		    uint64_t k = d[x << 5 | y] + d[1024 + ( x << 5 | y )];
+		    t.digraph[al][x][y] += k;
+		    if( !al ) t.single[x] += k, t.single[y] += k;
+		}
+	for( int x = 0; x < 26; x++ ) t.single[x] += _odd[x];
+	t.letters += _n;
+	fill( _dg.begin(), _dg.end(), 0 ); _odd.fill( 0 ); _n = 0;
+    }
+
+private:
+    vector<uint32_t> _dg; array<uint32_t, 32> _odd; uint64_t _n;
+};
+ 
+// bounded LRU cache of results keyed by ( key id, direction, input bytes ), split
+// into independently locked shards; limits are on entries and on stored bytes. The
+// entry limit is dealt out exactly over the shards, and a cache of fewer entries
+// than SHARDS uses only as many shards as it has entries
+class resultCache
+{
+public:
+    resultCache( size_t entries, size_t bytes ) :
+	_used( min( max( entries, size_t( 1 ) ), size_t( SHARDS ) ) ), _bytes( bytes / _used ), _hits( 0 ), _misses( 0 ), _evictions( 0 )
+    {
+	for( size_t x = 0; x < _used; x++ ) _shards[x].entries = entries / _used + ( x < entries % _used );
+    }
+
+    // K::doIt( t, n, e, out ) through the cache; out holds maxReady( n ) bytes
+    template< class K > size_t doIt( const K& k, const char* t, size_t n, bool e, char* out )
+    {
+	uint64_t h = hashBytes( t, n, k.id() ^ e ); shard& s = _shards[h % _used];
+	{
+	    lock_guard<mutex> l( s.m );
+	    index::iterator i = s.map.find( h );
+	    if( i != s.map.end() && i->second->kid == k.id() && i->second->e == e && i->second->in.compare( 0, string::npos, t, n ) == 0 )
+	    {
+		s.lru.splice( s.lru.begin(), s.lru, i->second ); _hits++;
+		memcpy( out, i->second->out.data(), i->second->out.length() );
+		return i->second->out.length();
+	    }
+	}
+	_misses++; size_t len = k.doIt( t, n, e, out );
+	if( !s.entries ) return len;
+	lock_guard<mutex> l( s.m );
+	index::iterator i = s.map.find( h );
+	if( i != s.map.end() ) drop( s, i->second );
+	entry en = { h, k.id(), e, string( t, n ), string( out, len ) };
+	s.lru.push_front( en ); s.map[h] = s.lru.begin(); s.bytes += n + len;
+	while( s.lru.size() > s.entries || ( s.bytes > _bytes && s.lru.size() > 1 ) ) { drop( s, --s.lru.end() ); _evictions++; }
+	return len;
+    }
+
+    size_t hits() const { return _hits; }
+    size_t misses() const { return _misses; }
+    size_t evictions() const { return _evictions; }
+    double hitRate() const { size_t a = _hits + _misses; return a ? double( _hits ) / a : 0; }
+
+private:
+    enum { SHARDS = 16 };
+    struct entry { uint64_t h, kid; bool e; string in, out; };
+    typedef list<entry> lruList;
+    typedef unordered_map< uint64_t, lruList::iterator > index;
+    struct shard { mutex m; lruList lru; index map; size_t entries, bytes = 0; };
+
+    static void drop( shard& s, lruList::iterator i )
+    {
+	s.bytes -= i->in.length() + i->out.length(); s.map.erase( i->h ); s.lru.erase( i );
+    }
+
+    size_t _used, _bytes; shard _shards[SHARDS];
+    atomic<size_t> _hits, _misses, _evictions;
+};
+ 
+// Compiled keys by name, published as immutable snapshots. Readers take no locks:
+// each reader owns a slot announcing the epoch it entered in, and a replaced
+// snapshot is freed only once every slot is idle or has entered a later epoch.
+template< class K > class keyRegistry
+{
+public:
+    typedef map< string, shared_ptr<const K> > snapshot;
+    enum { SLOTS = 256 };
+
+    struct alignas( 64 ) slot { atomic<uint64_t> active; atomic<bool> used; };
+
+    class reader
+    {
+    public:
+	reader( keyRegistry& r ) : _r( r ), _s( r.claim() ) {}
+	~reader() { if( _s ) _s->used.store( false, memory_order_release ); }
+	bool ok() const { return _s != 0; }
+	const snapshot& enter() { _s->active.store( _r._epoch.load() ); return *_r._cur.load(); }
+	void exit() { _s->active.store( 0, memory_order_release ); }
+
+    private:
+	keyRegistry& _r; slot* _s;
+    };
+
+    keyRegistry() : _cur( new snapshot ), _epoch( 1 )
+    {
+	for( int x = 0; x < SLOTS; x++ ) _slots[x].active = 0, _slots[x].used = false;
+    }
+
+    ~keyRegistry()
+    {
+	delete _cur.load();
+	for( size_t x = 0; x < _retired.size(); x++ ) delete _retired[x].second;
+    }
+
+    // writers only; the caller keeps its own reference to copy from
+    const snapshot& current() const { return *_cur.load(); }
+
+    void publish( snapshot* s )
+    {
+	lock_guard<mutex> l( _w );
+	snapshot* old = _cur.exchange( s );
+	_retired.push_back( make_pair( ++_epoch, old ) ); reclaim( l );
+    }
+
+    // frees the snapshots no reader can still see; returns how many are pending
+    size_t reclaim()
+    {
+	lock_guard<mutex> l( _w ); return reclaim( l );
+    }
+
+private:
+    slot* claim()
+    {
+	for( int x = 0; x < SLOTS; x++ )
+	{
+	    bool f = false;
+	    if( _slots[x].used.compare_exchange_strong( f, true ) ) return &_slots[x];
+	}
+	return 0;
+    }
+
+    size_t reclaim( lock_guard<mutex>& )
+    {
+	uint64_t low = UINT64_MAX;
+	for( int x = 0; x < SLOTS; x++ ) { uint64_t a = _slots[x].active.load(); if( a && a < low ) low = a; }
+	size_t k = 0;
+	for( size_t x = 0; x < _retired.size(); x++ )
+	    if( _retired[x].first <= low ) delete _retired[x].second;
+	    else _retired[k++] = _retired[x];
+	_retired.resize( k ); return k;
+    }
+
+    atomic<snapshot*> _cur; atomic<uint64_t> _epoch; slot _slots[SLOTS];
+    mutex _w; vector< pair<uint64_t, snapshot*> > _retired;
+};
+ 
+// HDR-style latency histogram in nanoseconds: power-of-two ranges, each split into
+// 2^SUB linear buckets (about 3% relative error), up to 2^41 ns. Only the owning
+// thread records, with relaxed stores; other threads merge copies on demand.
+class latencyHistogram
+{
+public:
+    enum { SUB = 5, TOP = 40, BUCKETS = ( TOP - SUB + 2 ) << SUB };
+
+    latencyHistogram() { clear(); }
+
+    void clear()
+    {
+	for( int x = 0; x < BUCKETS; x++ ) _c[x] = 0;
+	_n = _sum = _max = 0;
+    }
+
+    void record( uint64_t ns )
+    {
+	add( _c[index( ns )], 1 ); add( _n, 1 ); add( _sum, ns );
+	if( ns > _max.load( memory_order_relaxed ) ) _max.store( ns, memory_order_relaxed );
+    }
+
+    void merge( const latencyHistogram& h )
+    {
+	for( int x = 0; x < BUCKETS; x++ ) _c[x] += h._c[x].load( memory_order_relaxed );
+	_n += h._n.load( memory_order_relaxed ); _sum += h._sum.load( memory_order_relaxed );
+	_max = max( _max.load(), h._max.load( memory_order_relaxed ) );
+    }
+
+    uint64_t count() const { return _n; }
+    uint64_t sum() const { return _sum; }
+    uint64_t maximum() const { return _max; }
+
+    // upper edge of the bucket holding the p-th fraction of samples
+    uint64_t percentile( double p ) const
+    {
+	uint64_t n = _n, want = max( uint64_t( ceil( p * n ) ), uint64_t( 1 ) ), seen = 0;
+	if( !n ) return 0;
+	for( int x = 0; x < BUCKETS; x++ )
+	    if( ( seen += _c[x] ) >= want ) return min( value( x ), _max.load() );
+	return _max;
+    }
+
+    // {"count":..,"mean_ns":..,"p50_ns":..,"p99_ns":..,"p999_ns":..,"max_ns":..}
+    string json() const
+    {
+	ostringstream o;
+	o << "{\"count\":" << count() << ",\"mean_ns\":" << ( count() ? sum() / count() : 0 ) << ",\"p50_ns\":" << percentile( .5 )
+	  << ",\"p99_ns\":" << percentile( .99 ) << ",\"p999_ns\":" << percentile( .999 ) << ",\"max_ns\":" << maximum() << "}";
+	return o.str();
+    }
+
+private:
+    static void add( atomic<uint64_t>& a, uint64_t v ) { a.store( a.load( memory_order_relaxed ) + v, memory_order_relaxed ); }
+
+    static int index( uint64_t v )
+    {
+	if( v < ( 1u << SUB ) ) return v;
+	v = min( v, ( uint64_t( 2 ) << TOP ) - 1 );
+	int k = 63 - __builtin_clzll( v );
+	return ( ( k - SUB + 1 ) << SUB ) + ( ( v >> ( k - SUB ) ) & ( ( 1 << SUB ) - 1 ) );
+    }
+
+    static uint64_t value( int x )
+    {
+	if( x < ( 1 << SUB ) ) return x;
+	int k = ( x >> SUB ) + SUB - 1; uint64_t sub = x & ( ( 1 << SUB ) - 1 );
+	return ( ( ( uint64_t( 1 ) << SUB | sub ) + 1 ) << ( k - SUB ) ) - 1;
+    }
+
+    atomic<uint64_t> _c[BUCKETS], _n, _sum, _max;
+};
+ 
+// Bounded queue between pipeline stages with hysteresis: once it holds high items
+// it is full until drained to low, so a stalled consumer holds producers back
+// instead of growing memory. push() waits for room; tryPush() never waits, for
+// callers that shed load instead. close() wakes everyone and ends pop() once empty.
+template< class T > class boundedQueue
+{
+public:
+    boundedQueue( size_t high, size_t low ) : _high( max( high, size_t( 1 ) ) ), _low( min( low, _high - 1 ) ), _full( false ), _closed( false ), _peak( 0 ) {}
+
+    bool push( T v )
+    {
+	unique_lock<mutex> l( _m ); _notFull.wait( l, [this]() { return !_full || _closed; } );
+	return put( v, l );
+    }
+
+    bool tryPush( T& v )
+    {
+	unique_lock<mutex> l( _m ); if( _full ) return false;
+	return put( v, l );
+    }
+
+    bool pop( T& v )
+    {
+	unique_lock<mutex> l( _m ); _notEmpty.wait( l, [this]() { return !_q.empty() || _closed; } );
+	if( _q.empty() ) return false;
+	v = move( _q.front() ); _q.pop_front();
+	if( _full && _q.size() <= _low ) { _full = false; _notFull.notify_all(); }
+	return true;
+    }
+
+    void close()
+    {
+	lock_guard<mutex> l( _m ); _closed = true; _notFull.notify_all(); _notEmpty.notify_all();
+    }
+
+    size_t size() const { lock_guard<mutex> l( _m ); return _q.size(); }
+    size_t peak() const { lock_guard<mutex> l( _m ); return _peak; }
+
+private:
+    bool put( T& v, unique_lock<mutex>& )
+    {
+	if( _closed ) return false;
+	_q.push_back( move( v ) ); _peak = max( _peak, _q.size() );
+	if( _q.size() >= _high ) _full = true;
+	_notEmpty.notify_one(); return true;
+    }
+
+    mutable mutex _m; condition_variable _notFull, _notEmpty; deque<T> _q;
+    size_t _high, _low; bool _full, _closed; size_t _peak;
+};
+ 
+#endif
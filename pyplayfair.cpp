@@ -0,0 +1,174 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <new>
+#include <vector>
+#include "cplayfair.h"
+ 
+// Python bindings over the C API. Every function takes any object exporting a
+// contiguous buffer (bytes, bytearray, memoryview, numpy arrays) without copying it,
+// and the GIL is released while the cipher runs on large inputs.
+ 
+enum { NOGIL = 1 << 14 };
+ 
+struct keyObject
+{
+    PyObject_HEAD
+    pf_key* k;
+};
+ 
+struct view
+{
+    Py_buffer b; bool ok;
+    view( PyObject* o, int flags ) { ok = PyObject_GetBuffer( o, &b, flags | PyBUF_C_CONTIGUOUS ) == 0; }
+    ~view() { if( ok ) PyBuffer_Release( &b ); }
+    const char* ptr() const { return ( const char* )b.buf; }
+    size_t len() const { return b.len; }
+};
+ 
+static size_t crypt( const pf_key* k, const char* in, size_t len, char* out, int e )
+{
+    size_t n;
+    if( len < NOGIL ) return pf_crypt( k, in, len, out, e );
+    Py_BEGIN_ALLOW_THREADS
+    n = pf_crypt( k, in, len, out, e );
+    Py_END_ALLOW_THREADS
+    return n;
+}
+ 
+static int keyInit( keyObject* self, PyObject* args, PyObject* kw )
+{
+    static const char* names[] = { "key", "key2", "drop_q", "alnum", "bytes", "square", 0 };
+    Py_buffer k1, k2 = Py_buffer(); int q = 0, an = 0, by = 0, sq = 0; unsigned flags;
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "y*|y*ppp$i", ( char** )names, &k1, &k2, &q, &an, &by, &sq ) ) return -1;
+    flags = ( q ? PF_DROP_Q : 0 ) | ( an ? PF_ALNUM : 0 ) | ( by ? PF_BYTES : 0 );
+    if( sq == 2 ) flags |= PF_TWO_SQUARE; else if( sq == 4 ) flags |= PF_FOUR_SQUARE;
+    pf_key_free( self->k );
+    self->k = sq ? pf_key_new2( ( const char* )k1.buf, k1.len, ( const char* )k2.buf, k2.len, flags )
+                 : pf_key_new( ( const char* )k1.buf, k1.len, flags );
+    PyBuffer_Release( &k1 ); if( k2.obj ) PyBuffer_Release( &k2 );
+    if( !self->k ) { PyErr_SetString( PyExc_ValueError, "invalid key options" ); return -1; }
+    return 0;
+}
+ 
+static void keyDealloc( keyObject* self )
+{
+    pf_key_free( self->k ); Py_TYPE( self )->tp_free( ( PyObject* )self );
+}
+ 
+// a Key made by __new__ alone has no compiled key
+static bool ready( keyObject* self )
+{
+    if( !self->k ) PyErr_SetString( PyExc_ValueError, "Key is not initialized" );
+    return self->k;
+}
+ 
+static PyObject* cryptTo( keyObject* self, PyObject* src, int e )
+{
+    if( !ready( self ) ) return 0;
+    view in( src, PyBUF_SIMPLE ); if( !in.ok ) return 0;
+    PyObject* r = PyBytes_FromStringAndSize( 0, pf_max_output( in.len() ) ); if( !r ) return 0;
+    size_t n = crypt( self->k, in.ptr(), in.len(), PyBytes_AS_STRING( r ), e );
+    if( _PyBytes_Resize( &r, n ) < 0 ) return 0;
+    return r;
+}
+ 
+static PyObject* cryptInto( keyObject* self, PyObject* args, int e )
+{
+    PyObject *src, *dst; if( !ready( self ) || !PyArg_ParseTuple( args, "OO", &src, &dst ) ) return 0;
+    view in( src, PyBUF_SIMPLE ); if( !in.ok ) return 0;
+    view out( dst, PyBUF_WRITABLE ); if( !out.ok ) return 0;
+    if( out.len() < pf_max_output( in.len() ) ) { PyErr_SetString( PyExc_ValueError, "output buffer too small" ); return 0; }
+    return PyLong_FromSize_t( crypt( self->k, in.ptr(), in.len(), ( char* )out.b.buf, e ) );
+}
+ 
+// all items go through one pf_crypt_batch call into a single buffer, with the GIL
+// released once the total is large enough, and are split into bytes afterwards
+static PyObject* cryptBatch( keyObject* self, PyObject* seq, int e )
+{
+    if( !ready( self ) ) return 0;
+    PyObject* items = PySequence_Fast( seq, "expected a sequence of buffers" ); if( !items ) return 0;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE( items ), got = 0; PyObject* r = 0;
+    try
+    {
+	std::vector<Py_buffer> b( n ); std::vector<pf_slice> in( n ); std::vector<size_t> off( n + 1 ); size_t cap = 0;
+	for( ; got < n; got++ )
+	{
+	    if( PyObject_GetBuffer( PySequence_Fast_GET_ITEM( items, got ), &b[got], PyBUF_SIMPLE | PyBUF_C_CONTIGUOUS ) < 0 ) break;
+	    in[got].ptr = ( const char* )b[got].buf; in[got].len = b[got].len; cap += pf_max_output( b[got].len );
+	}
+	if( got == n )
+	{
+	    std::vector<char> out( cap );
+	    if( cap < NOGIL ) pf_crypt_batch( self->k, in.data(), n, out.data(), cap, off.data(), e );
+	    else
+	    {
+		Py_BEGIN_ALLOW_THREADS
+		pf_crypt_batch( self->k, in.data(), n, out.data(), cap, off.data(), e );
+		Py_END_ALLOW_THREADS
+	    }
+	    r = PyList_New( n );
+	    for( Py_ssize_t x = 0; r && x < n; x++ )
+	    {
+		PyObject* o = PyBytes_FromStringAndSize( out.data() + off[x], off[x + 1] - off[x] );
+		if( !o ) { Py_CLEAR( r ); break; }
+		PyList_SET_ITEM( r, x, o );
+	    }
+	}
+	for( Py_ssize_t x = 0; x < got; x++ ) PyBuffer_Release( &b[x] );
+    }
+    catch( std::bad_alloc& ) { PyErr_NoMemory(); }
+    Py_DECREF( items ); return r;
+}
+ 
+static PyObject* encrypt( keyObject* self, PyObject* o ) { return cryptTo( self, o, 1 ); }
+static PyObject* decrypt( keyObject* self, PyObject* o ) { return cryptTo( self, o, 0 ); }
+static PyObject* encryptInto( keyObject* self, PyObject* a ) { return cryptInto( self, a, 1 ); }
+static PyObject* decryptInto( keyObject* self, PyObject* a ) { return cryptInto( self, a, 0 ); }
+static PyObject* encryptBatch( keyObject* self, PyObject* o ) { return cryptBatch( self, o, 1 ); }
+static PyObject* decryptBatch( keyObject* self, PyObject* o ) { return cryptBatch( self, o, 0 ); }
+static PyObject* maxOutput( PyObject*, PyObject* o )
+{
+    size_t n = PyLong_AsSize_t( o ); if( PyErr_Occurred() ) return 0;
+    return PyLong_FromSize_t( pf_max_output( n ) );
+}
+ 
+static PyMethodDef keyMethods[] =
+{
+    { "encrypt", ( PyCFunction )encrypt, METH_O, "encrypt(buffer) -> bytes" },
+    { "decrypt", ( PyCFunction )decrypt, METH_O, "decrypt(buffer) -> bytes" },
+    { "encrypt_into", ( PyCFunction )encryptInto, METH_VARARGS, "encrypt_into(src, dst) -> length written to dst" },
+    { "decrypt_into", ( PyCFunction )decryptInto, METH_VARARGS, "decrypt_into(src, dst) -> length written to dst" },
+    { "encrypt_batch", ( PyCFunction )encryptBatch, METH_O, "encrypt_batch(buffers) -> list of bytes" },
+    { "decrypt_batch", ( PyCFunction )decryptBatch, METH_O, "decrypt_batch(buffers) -> list of bytes" },
+    { 0 }
+};
+ 
+static PyTypeObject keyType =
+{
+    PyVarObject_HEAD_INIT( 0, 0 )
+    "playfair.Key",
+};
+ 
+static PyMethodDef moduleMethods[] =
+{
+    { "max_output", maxOutput, METH_O, "max_output(n) -> output bytes needed for n input bytes" },
+    { 0 }
+};
+ 
+static PyModuleDef module = { PyModuleDef_HEAD_INIT, "playfair", "Compiled Playfair keys over the buffer protocol.", -1, moduleMethods };
+ 
+PyMODINIT_FUNC PyInit_playfair()
+{
+    keyType.tp_basicsize = sizeof( keyObject );
+    keyType.tp_flags = Py_TPFLAGS_DEFAULT;
+    keyType.tp_doc = "Key(key, key2=b'', drop_q=False, alnum=False, bytes=False, *, square=0)";
+    keyType.tp_new = PyType_GenericNew;
+    keyType.tp_init = ( initproc )keyInit;
+    keyType.tp_dealloc = ( destructor )keyDealloc;
+    keyType.tp_methods = keyMethods;
+    if( PyType_Ready( &keyType ) < 0 ) return 0;
+    PyObject* m = PyModule_Create( &module ); if( !m ) return 0;
+    Py_INCREF( &keyType );
+    if( PyModule_AddObject( m, "Key", ( PyObject* )&keyType ) < 0 ) { Py_DECREF( &keyType ); Py_DECREF( m ); return 0; }
+    return m;
+}